@@ -3,130 +3,1637 @@
 #include <string.h>
 
 #include "arocks.h"
+#include "arocks_commit.h"
+#include "arocks_doc.h"
+#include "arocks_index.h"
+#include "arocks_merge.h"
+#include "arocks_profile.h"
+#include "arocks_stats.h"
+#include "arocks_txn.h"
+#include "cJSON.h"
+#include "json_path.h"
+#include "key_codec.h"
 #include "rocksdb/c.h"
 
+#include <ctype.h>
+#include <pthread.h>
 #include <unistd.h> // sysconf() - get CPU count
 
-#define ERR(err)                                                               \
-  if (err) {                                                                   \
-    fprintf(stderr, "Error: %s\n", err);                                       \
-    abort();                                                                   \
-  }
-
-void arocks_insert_db(rocksdb_t *db, const char *key, const char *value) {
+/* key is in its stored form (arocks_key_encode). batch, when given, holds
+ * writes (index entries) that have to commit atomically with the put. vlen
+ * counts the value's '\0' for text. */
+void arocks_insert_db(rocksdb_t *db, const rocksdb_writeoptions_t *writeoptions,
+                      rocksdb_column_family_handle_t *cf,
+                      rocksdb_writebatch_t *batch, const char *key,
+                      size_t klen, const char *value, size_t vlen) {
   char *err = NULL;
-  // Put key-value
-  rocksdb_writeoptions_t *writeoptions = rocksdb_writeoptions_create();
-  // add 1 to len to account for null character in string key and value
-  rocksdb_put(db, writeoptions, key, strlen(key) + 1, value, strlen(value) + 1,
-              &err);
+  if (batch == NULL) {
+    rocksdb_put_cf(db, writeoptions, cf, key, klen, value, vlen, &err);
+  } else {
+    rocksdb_writebatch_put_cf(batch, cf, key, klen, value, vlen);
+    rocksdb_write(db, writeoptions, batch, &err);
+  }
   ERR(err);
-  rocksdb_writeoptions_destroy(writeoptions);
 }
 
-char *arocks_select_db(rocksdb_t *db, const char *key) {
+char *arocks_select_db(rocksdb_t *db, const rocksdb_readoptions_t *readoptions,
+                       rocksdb_column_family_handle_t *cf, const char *key,
+                       size_t klen) {
   char *err = NULL;
-  rocksdb_readoptions_t *readoptions = rocksdb_readoptions_create();
   size_t len;
   char *returned_value =
-      rocksdb_get(db, readoptions, key, strlen(key) + 1, &len, &err);
+      rocksdb_get_cf(db, readoptions, cf, key, klen, &len, &err);
   ERR(err);
-  rocksdb_readoptions_destroy(readoptions);
+  if (returned_value != NULL && arocks_doc_is_binary(returned_value, len)) {
+    char *text = arocks_doc_text(returned_value, len);
+    free(returned_value);
+    return text;
+  }
   return returned_value;
 }
 
-rocksdb_t *arocks_init(char *db_path, rocksdb_options_t *options) {
+/*
+** Configuration
+*/
+
+arocks_config_t arocks_config_defaults(void) {
+  arocks_config_t cfg;
+  cfg.parallelism = 0;
+  cfg.max_background_jobs = 0;
+  cfg.write_buffer_size = 0;
+  cfg.max_write_buffer_number = 0;
+  cfg.compaction_style = AROCKS_COMPACTION_LEVEL;
+  cfg.fifo_max_bytes = 0;
+  cfg.num_levels = 0;
+  cfg.target_file_size_base = 0;
+  cfg.max_bytes_for_level_base = 0;
+  cfg.level0_compaction_trigger = 0;
+  cfg.disable_auto_compactions = 0;
+  cfg.block_size = 0;
+  cfg.compression_levels = 0;
+  cfg.zstd_dict_bytes = 0;
+  cfg.zstd_train_bytes = 0;
+  cfg.blob_files = 0;
+  cfg.min_blob_size = 0;
+  cfg.blob_file_size = 0;
+  cfg.blob_compression = 0;
+  cfg.blob_gc = 0;
+  cfg.blob_gc_age_cutoff = 0;
+  cfg.prefix_type = AROCKS_PREFIX_NONE;
+  cfg.prefix_len = 0;
+  cfg.prefix_delim = ':';
+  cfg.bloom_bits = 10;
+  cfg.whole_key_filtering = 1;
+  cfg.memtable_bloom_ratio = 0.1;
+  cfg.cache_size = 64 << 20;
+  cfg.cache_type = AROCKS_CACHE_LRU;
+  cfg.cache_index_and_filter_blocks = 0;
+  cfg.pin_l0_filter_and_index_blocks = 0;
+  cfg.statistics = 0;
+  cfg.binary_docs = 0;
+  cfg.key_order = AROCKS_KEYS_BYTES;
+  cfg.ttl = 0;
+  cfg.column_family = NULL;
+  cfg.sync_writes = 0;
+  cfg.group_commit = 0;
+  cfg.group_commit_bytes = 1 << 20;
+  cfg.group_commit_delay_us = 0;
+  cfg.transactions = 0;
+  cfg.txn_retries = 10;
+  return cfg;
+}
+
+int arocks_config_prefix(arocks_config_t *cfg, const char *spec) {
+  char *end = NULL;
+  if (strncmp(spec, "fixed:", 6) == 0) {
+    cfg->prefix_type = AROCKS_PREFIX_FIXED;
+    cfg->prefix_len = (int)strtol(spec + 6, &end, 10);
+  } else if (strncmp(spec, "capped:", 7) == 0) {
+    cfg->prefix_type = AROCKS_PREFIX_CAPPED;
+    cfg->prefix_len = (int)strtol(spec + 7, &end, 10);
+  } else if (strncmp(spec, "delim:", 6) == 0 && spec[6] != '\0' &&
+             spec[7] == ':') {
+    cfg->prefix_type = AROCKS_PREFIX_DELIM;
+    cfg->prefix_delim = spec[6];
+    cfg->prefix_len = (int)strtol(spec + 8, &end, 10);
+  } else if (strcmp(spec, "none") == 0) {
+    cfg->prefix_type = AROCKS_PREFIX_NONE;
+    return 0;
+  } else {
+    return -1;
+  }
+  return (end == NULL || *end != '\0' || cfg->prefix_len <= 0) ? -1 : 0;
+}
+
+int arocks_config_key_order(arocks_config_t *cfg, const char *name) {
+  if (strcmp(name, "bytes") == 0) {
+    cfg->key_order = AROCKS_KEYS_BYTES;
+  } else if (strcmp(name, "natural") == 0) {
+    cfg->key_order = AROCKS_KEYS_NATURAL;
+  } else if (strcmp(name, "typed") == 0) {
+    cfg->key_order = AROCKS_KEYS_TYPED;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+int arocks_config_cache_type(arocks_config_t *cfg, const char *name) {
+  if (strcmp(name, "lru") == 0) {
+    cfg->cache_type = AROCKS_CACHE_LRU;
+  } else if (strcmp(name, "hyper-clock") == 0) {
+    cfg->cache_type = AROCKS_CACHE_HYPER_CLOCK;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/*
+** The delimiter prefix ("tenant:type:" of "tenant:type:id") isn't one of
+** RocksDB's built in slice transforms, so it is supplied as callbacks.
+*/
+typedef struct delim_prefix {
+  char delim;
+  int count;
+  char name[32]; // checked against the name the filters were built with
+} delim_prefix;
+
+/* length of the prefix through the count-th delimiter, 0 if there isn't one */
+static size_t delim_prefix_len(const delim_prefix *dp, const char *key,
+                               size_t length) {
+  int seen = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (key[i] == dp->delim && ++seen == dp->count) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+static char *delim_prefix_transform(void *state, const char *key,
+                                    size_t length, size_t *dst_length) {
+  *dst_length = delim_prefix_len(state, key, length);
+  return (char *)key;
+}
+
+static unsigned char delim_prefix_in_domain(void *state, const char *key,
+                                            size_t length) {
+  return delim_prefix_len(state, key, length) > 0;
+}
+
+static unsigned char delim_prefix_in_range(void *state, const char *key,
+                                           size_t length) {
+  return 0;
+}
+
+static const char *delim_prefix_name(void *state) {
+  return ((delim_prefix *)state)->name;
+}
+
+static rocksdb_slicetransform_t *
+arocks_prefix_extractor(const arocks_config_t *cfg) {
+  switch (cfg->prefix_type) {
+  case AROCKS_PREFIX_FIXED:
+    return rocksdb_slicetransform_create_fixed_prefix(cfg->prefix_len);
+  case AROCKS_PREFIX_CAPPED:
+    return rocksdb_slicetransform_create_capped_prefix(cfg->prefix_len);
+  case AROCKS_PREFIX_DELIM: {
+    delim_prefix *dp = malloc(sizeof(delim_prefix));
+    dp->delim = cfg->prefix_delim;
+    dp->count = cfg->prefix_len;
+    snprintf(dp->name, sizeof(dp->name), "modric.delim.%02x.%d",
+             (unsigned char)dp->delim, dp->count);
+    return rocksdb_slicetransform_create(
+        dp, free, delim_prefix_transform, delim_prefix_in_domain,
+        delim_prefix_in_range, delim_prefix_name);
+  }
+  }
+  return NULL;
+}
+
+/*
+** Natural key order: runs of digits compare by value, so "item9" sorts
+** before "item10", with leading zeros only breaking ties ("a1" < "a01").
+** Everything else compares bytewise, including system keys, which hold
+** binary encodings whose bytes only look like digits.
+*/
+static int natural_compare(const char *a, size_t alen, const char *b,
+                           size_t blen) {
+  if ((alen > 0 && a[0] == AROCKS_SYS_PREFIX[0]) ||
+      (blen > 0 && b[0] == AROCKS_SYS_PREFIX[0])) {
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    return c != 0 ? c : (alen > blen) - (alen < blen);
+  }
+  size_t i = 0, j = 0;
+  int zeros = 0;
+  while (i < alen && j < blen) {
+    if (!isdigit((unsigned char)a[i]) || !isdigit((unsigned char)b[j])) {
+      if (a[i] != b[j]) {
+        return (unsigned char)a[i] < (unsigned char)b[j] ? -1 : 1;
+      }
+      i++;
+      j++;
+      continue;
+    }
+    size_t za = i, zb = j;
+    while (za < alen && a[za] == '0') {
+      za++;
+    }
+    while (zb < blen && b[zb] == '0') {
+      zb++;
+    }
+    size_t ea = za, eb = zb;
+    while (ea < alen && isdigit((unsigned char)a[ea])) {
+      ea++;
+    }
+    while (eb < blen && isdigit((unsigned char)b[eb])) {
+      eb++;
+    }
+    // more significant digits is a bigger number
+    if (ea - za != eb - zb) {
+      return ea - za < eb - zb ? -1 : 1;
+    }
+    int c = memcmp(a + za, b + zb, ea - za);
+    if (c != 0) {
+      return c;
+    }
+    if (zeros == 0 && za - i != zb - j) {
+      zeros = za - i < zb - j ? -1 : 1;
+    }
+    i = ea;
+    j = eb;
+  }
+  if (i < alen || j < blen) {
+    return i < alen ? 1 : -1;
+  }
+  return zeros;
+}
+
+static int natural_comparator_compare(void *state, const char *a, size_t alen,
+                                      const char *b, size_t blen) {
+  return natural_compare(a, alen, b, blen);
+}
+
+static void natural_comparator_destroy(void *state) {}
+
+static const char *natural_comparator_name(void *state) {
+  return "modric.natural";
+}
+
+/* Options don't own their comparator, and it has to outlive every DB opened
+ * with it, so there's one for the whole process. */
+static pthread_once_t natural_once = PTHREAD_ONCE_INIT;
+static rocksdb_comparator_t *natural_comparator = NULL;
+
+static void natural_comparator_create(void) {
+  natural_comparator = rocksdb_comparator_create(
+      NULL, natural_comparator_destroy, natural_comparator_compare,
+      natural_comparator_name);
+}
+
+/*
+** One block cache for the whole process, so long running modes with several
+** sessions size memory once. Sessions take a reference when they open and
+** drop it when they close.
+*/
+static pthread_mutex_t shared_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static rocksdb_cache_t *shared_cache = NULL;
+static int shared_cache_refs = 0;
+
+static rocksdb_cache_t *shared_cache_acquire(const arocks_config_t *cfg) {
+  pthread_mutex_lock(&shared_cache_lock);
+  if (shared_cache == NULL) {
+    if (cfg->cache_type == AROCKS_CACHE_HYPER_CLOCK) {
+      // an entry charge of 0 lets the cache size its table as it fills
+      shared_cache = rocksdb_cache_create_hyper_clock(cfg->cache_size, 0);
+    } else {
+      shared_cache = rocksdb_cache_create_lru(cfg->cache_size);
+    }
+  }
+  shared_cache_refs++;
+  rocksdb_cache_t *cache = shared_cache;
+  pthread_mutex_unlock(&shared_cache_lock);
+  return cache;
+}
+
+static void shared_cache_release(void) {
+  pthread_mutex_lock(&shared_cache_lock);
+  // the DBs hold their own references, this only drops the process's
+  if (--shared_cache_refs == 0) {
+    rocksdb_cache_destroy(shared_cache);
+    shared_cache = NULL;
+  }
+  pthread_mutex_unlock(&shared_cache_lock);
+}
+
+// RocksDB's DEFAULT_MEMTABLE_MEMORY_BUDGET for the Optimize* calls
+#define MEMTABLE_BUDGET_DEFAULT ((uint64_t)512 << 20)
+
+static void config_compaction(rocksdb_options_t *options,
+                              const arocks_config_t *cfg) {
+  // a budget of 0 would size the memtables at 0, which RocksDB raises to
+  // its 64KB minimum
+  uint64_t budget = cfg->write_buffer_size > 0
+                        ? (uint64_t)cfg->write_buffer_size * 4
+                        : MEMTABLE_BUDGET_DEFAULT;
+  switch (cfg->compaction_style) {
+  case AROCKS_COMPACTION_UNIVERSAL:
+    rocksdb_options_optimize_universal_style_compaction(options, budget);
+    break;
+  case AROCKS_COMPACTION_FIFO: {
+    rocksdb_options_set_compaction_style(options, rocksdb_fifo_compaction);
+    if (cfg->fifo_max_bytes > 0) {
+      rocksdb_fifo_compaction_options_t *fifo =
+          rocksdb_fifo_compaction_options_create();
+      rocksdb_fifo_compaction_options_set_max_table_files_size(
+          fifo, cfg->fifo_max_bytes);
+      rocksdb_options_set_fifo_compaction_options(options, fifo);
+      rocksdb_fifo_compaction_options_destroy(fifo);
+    }
+    break;
+  }
+  default:
+    rocksdb_options_optimize_level_style_compaction(options, budget);
+    break;
+  }
+  // anything set explicitly wins over what the optimize calls picked
+  if (cfg->write_buffer_size > 0) {
+    rocksdb_options_set_write_buffer_size(options, cfg->write_buffer_size);
+  }
+  if (cfg->max_write_buffer_number > 0) {
+    rocksdb_options_set_max_write_buffer_number(options,
+                                                cfg->max_write_buffer_number);
+  }
+  if (cfg->num_levels > 0) {
+    rocksdb_options_set_num_levels(options, cfg->num_levels);
+  }
+  if (cfg->target_file_size_base > 0) {
+    rocksdb_options_set_target_file_size_base(options,
+                                              cfg->target_file_size_base);
+  }
+  if (cfg->max_bytes_for_level_base > 0) {
+    rocksdb_options_set_max_bytes_for_level_base(options,
+                                                 cfg->max_bytes_for_level_base);
+  }
+  if (cfg->level0_compaction_trigger > 0) {
+    rocksdb_options_set_level0_file_num_compaction_trigger(
+        options, cfg->level0_compaction_trigger);
+  }
+  if (cfg->disable_auto_compactions) {
+    rocksdb_options_set_disable_auto_compactions(options, 1);
+  }
+  if (cfg->ttl > 0) {
+    rocksdb_options_set_ttl(options, cfg->ttl);
+  }
+  if (cfg->compression_levels > 0) {
+    int levels[AROCKS_MAX_LEVELS];
+    int n = cfg->num_levels > 0 ? cfg->num_levels : 7;
+    n = n > AROCKS_MAX_LEVELS ? AROCKS_MAX_LEVELS : n;
+    for (int i = 0; i < n; i++) {
+      int last = cfg->compression_levels - 1;
+      levels[i] = cfg->compression[i < last ? i : last];
+    }
+    rocksdb_options_set_compression_per_level(options, levels, n);
+  }
+}
+
+// RocksDB's kDefaultCompressionLevel, zstd's own default
+#define ZSTD_DEFAULT_LEVEL 32767
+
+/* Dictionaries only apply to zstd levels, so with no per level choice every
+ * level gets zstd. RocksDB trains one dictionary per SST file, from samples
+ * of the file's data blocks, when it writes the file. */
+static void config_dictionary(rocksdb_options_t *options,
+                              const arocks_config_t *cfg) {
+  if (cfg->zstd_dict_bytes <= 0) {
+    return;
+  }
+  if (cfg->compression_levels == 0) {
+    rocksdb_options_set_compression(options, rocksdb_zstd_compression);
+  }
+  int train = cfg->zstd_train_bytes > 0 ? cfg->zstd_train_bytes
+                                        : cfg->zstd_dict_bytes * 100;
+  rocksdb_options_set_compression_options(options, -14, ZSTD_DEFAULT_LEVEL, 0,
+                                          cfg->zstd_dict_bytes);
+  rocksdb_options_set_compression_options_zstd_max_train_bytes(options, train);
+}
+
+static void config_blobs(rocksdb_options_t *options,
+                         const arocks_config_t *cfg) {
+  if (!cfg->blob_files) {
+    return;
+  }
+  rocksdb_options_set_enable_blob_files(options, 1);
+  rocksdb_options_set_min_blob_size(options, cfg->min_blob_size);
+  if (cfg->blob_file_size > 0) {
+    rocksdb_options_set_blob_file_size(options, cfg->blob_file_size);
+  }
+  rocksdb_options_set_blob_compression_type(options, cfg->blob_compression);
+  rocksdb_options_set_enable_blob_gc(options, (unsigned char)cfg->blob_gc);
+  if (cfg->blob_gc_age_cutoff > 0) {
+    rocksdb_options_set_blob_gc_age_cutoff(options, cfg->blob_gc_age_cutoff);
+  }
+}
+
+/* Apply cfg to options, the parts that don't involve opening anything. */
+void arocks_config_options(rocksdb_options_t *options,
+                           const arocks_config_t *cfg) {
   // Optimize RocksDB. This is the easiest way to
   // get RocksDB to perform well.
   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
-  // Set # of online cores
-  rocksdb_options_increase_parallelism(options, (int)(cpus));
-  rocksdb_options_optimize_level_style_compaction(options, 0);
-  // create the DB if it's not already present
-  rocksdb_options_set_create_if_missing(options, 1);
-  // open DB
+  // Set # of online cores, unless told otherwise
+  rocksdb_options_increase_parallelism(
+      options, cfg->parallelism > 0 ? cfg->parallelism : (int)(cpus));
+  if (cfg->max_background_jobs > 0) {
+    rocksdb_options_set_max_background_jobs(options, cfg->max_background_jobs);
+  }
+  config_compaction(options, cfg);
+  config_dictionary(options, cfg);
+  config_blobs(options, cfg);
+
+  rocksdb_block_based_table_options_t *table_options =
+      rocksdb_block_based_options_create();
+  if (cfg->block_size > 0) {
+    rocksdb_block_based_options_set_block_size(table_options, cfg->block_size);
+  }
+  if (cfg->bloom_bits > 0) {
+    rocksdb_block_based_options_set_filter_policy(
+        table_options, rocksdb_filterpolicy_create_bloom_full(cfg->bloom_bits));
+  }
+  rocksdb_block_based_options_set_whole_key_filtering(
+      table_options, (unsigned char)cfg->whole_key_filtering);
+  rocksdb_block_based_options_set_block_cache(table_options, shared_cache);
+  rocksdb_block_based_options_set_cache_index_and_filter_blocks(
+      table_options, (unsigned char)cfg->cache_index_and_filter_blocks);
+  rocksdb_block_based_options_set_pin_l0_filter_and_index_blocks_in_cache(
+      table_options, (unsigned char)cfg->pin_l0_filter_and_index_blocks);
+  rocksdb_options_set_block_based_table_factory(options, table_options);
+  rocksdb_block_based_options_destroy(table_options);
+
+  if (cfg->statistics) {
+    rocksdb_options_enable_statistics(options);
+  }
+
+  rocksdb_slicetransform_t *prefix = arocks_prefix_extractor(cfg);
+  if (prefix != NULL) {
+    // options owns the extractor from here on
+    rocksdb_options_set_prefix_extractor(options, prefix);
+    rocksdb_options_set_memtable_prefix_bloom_size_ratio(
+        options, cfg->memtable_bloom_ratio);
+  }
+}
+
+/* What the OPTIONS file can't hold: a family loaded from it gets the
+ * process's comparator and merge operator back. */
+static void family_restore(rocksdb_options_t *options,
+                           const arocks_config_t *cfg) {
+  if (cfg->key_order == AROCKS_KEYS_NATURAL) {
+    pthread_once(&natural_once, natural_comparator_create);
+    rocksdb_options_set_comparator(options, natural_comparator);
+  }
+  // options owns the operator
+  rocksdb_options_set_merge_operator(options,
+                                     arocks_merge_operator(cfg->binary_docs));
+}
+
+/* Open the DB with every column family it holds, plus the session's if it's
+ * new. The session's family gets s->options, the others what they were
+ * last opened with. */
+void arocks_init(arocks_t *s, const char *db_path) {
+  const arocks_config_t *cfg = &s->config;
+  const char *family =
+      cfg->column_family != NULL ? cfg->column_family : "default";
+  arocks_config_options(s->options, cfg);
+  family_restore(s->options, cfg);
+  // create the DB and the session's family if they're not already present
+  rocksdb_options_set_create_if_missing(s->options, 1);
+  rocksdb_options_set_create_missing_column_families(s->options, 1);
+
+  char *err = NULL;
+  size_t nexisting = 0;
+  char **existing =
+      rocksdb_list_column_families(s->options, db_path, &nexisting, &err);
+  if (err != NULL) { // no DB yet
+    free(err);
+    err = NULL;
+    existing = NULL;
+    nexisting = 0;
+  }
+  rocksdb_options_t *db_options = NULL;
+  rocksdb_options_t **loaded = NULL;
+  char **loaded_names = NULL;
+  size_t nloaded = 0;
+  if (nexisting > 0) {
+    rocksdb_env_t *env = rocksdb_create_default_env();
+    // unknown settings (our comparator and merge operator) are skipped
+    rocksdb_load_latest_options(db_path, env, 1, shared_cache, &db_options,
+                                &nloaded, &loaded_names, &loaded, &err);
+    rocksdb_env_destroy(env);
+    if (err != NULL) {
+      free(err);
+      err = NULL;
+      nloaded = 0;
+    }
+  }
+
+  size_t n = 0;
+  const char **names = malloc((nexisting + 2) * sizeof(char *));
+  const rocksdb_options_t **options =
+      malloc((nexisting + 2) * sizeof(rocksdb_options_t *));
+  int target = -1;
+  if (nexisting == 0) {
+    names[n++] = "default";
+  }
+  for (size_t i = 0; i < nexisting; i++) {
+    names[n++] = existing[i];
+  }
+  for (size_t i = 0; i < n && target < 0; i++) {
+    target = strcmp(names[i], family) == 0 ? (int)i : -1;
+  }
+  if (target < 0) {
+    target = (int)n;
+    names[n++] = family;
+  }
+  for (size_t i = 0; i < n; i++) {
+    options[i] = s->options;
+    for (size_t j = 0; (int)i != target && j < nloaded; j++) {
+      if (strcmp(loaded_names[j], names[i]) == 0) {
+        family_restore(loaded[j], cfg);
+        options[i] = loaded[j];
+      }
+    }
+  }
+
+  s->families = malloc(n * sizeof(rocksdb_column_family_handle_t *));
+  s->nfamilies = (int)n;
+  s->txn_db = NULL;
+  if (cfg->transactions) {
+    s->db = arocks_txn_open(s, db_path, (int)n, names, options, &err);
+  } else {
+    s->db = rocksdb_open_column_families(s->options, db_path, (int)n, names,
+                                         options, s->families, &err);
+  }
+  ERR(err);
+  s->cf = s->families[target];
+
+  // the DB keeps copies of the options it was opened with
+  if (nloaded > 0) {
+    rocksdb_load_latest_options_destroy(db_options, loaded_names, loaded,
+                                        nloaded);
+  }
+  if (existing != NULL) {
+    rocksdb_list_column_families_destroy(existing, nexisting);
+  }
+  free(names);
+  free(options);
+}
+
+/*
+** Session API
+*/
+
+arocks_t *arocks_open(const char *db_path) {
+  arocks_config_t cfg = arocks_config_defaults();
+  return arocks_open_with(db_path, &cfg);
+}
+
+arocks_t *arocks_open_with(const char *db_path, const arocks_config_t *cfg) {
+  arocks_t *s = malloc(sizeof(arocks_t));
+  s->config = *cfg;
+  if (cfg->column_family != NULL) {
+    s->config.column_family = strdup(cfg->column_family);
+  }
+  s->latency = cfg->statistics ? calloc(1, sizeof(arocks_latency_t)) : NULL;
+  shared_cache_acquire(cfg);
+  s->options = rocksdb_options_create();
+  uint64_t start = arocks_timer_start(s);
+  arocks_init(s, db_path);
+  arocks_timer_stop(s, AROCKS_OP_OPEN, start);
+  // read/write options are reused by every call on the session
+  s->readoptions = rocksdb_readoptions_create();
+  s->writeoptions = rocksdb_writeoptions_create();
+  rocksdb_writeoptions_set_sync(s->writeoptions, cfg->sync_writes);
+  s->committer = cfg->group_commit ? arocks_commit_start(s) : NULL;
+  s->snapshots = NULL;
+  s->snapshot_ids = 0;
+  pthread_mutex_init(&s->snapshots_lock, NULL);
+  for (int i = 0; i < AROCKS_KEY_STRIPES; i++) {
+    pthread_mutex_init(&s->key_locks[i], NULL);
+  }
+  arocks_index_load(s);
+  return s;
+}
+
+void arocks_close(arocks_t *s) {
+  if (s == NULL) {
+    return;
+  }
+  if (s->committer != NULL) {
+    arocks_commit_stop(s->committer);
+  }
+  double oldest;
+  int open = arocks_snapshot_count(s, &oldest);
+  if (open > 0) {
+    fprintf(stderr, "releasing %d snapshots left open, oldest held %.1fs\n",
+            open, oldest);
+  }
+  while (s->snapshots != NULL) {
+    arocks_snapshot_release(s, s->snapshots);
+  }
+  pthread_mutex_destroy(&s->snapshots_lock);
+  for (int i = 0; i < AROCKS_KEY_STRIPES; i++) {
+    pthread_mutex_destroy(&s->key_locks[i]);
+  }
+  for (int i = 0; i < s->nfamilies; i++) {
+    rocksdb_column_family_handle_destroy(s->families[i]);
+  }
+  free(s->families);
+  if (s->txn_db != NULL) {
+    arocks_txn_close(s);
+  } else {
+    rocksdb_close(s->db);
+  }
+  rocksdb_readoptions_destroy(s->readoptions);
+  rocksdb_writeoptions_destroy(s->writeoptions);
+  rocksdb_options_destroy(s->options);
+  shared_cache_release();
+  arocks_index_free(s);
+  free((char *)s->config.column_family);
+  free(s->latency);
+  free(s);
+}
+
+/*
+** Keys
+*/
+
+const char *arocks_key_encode(const arocks_t *s, const char *key,
+                              key_buf_t *b, size_t *len) {
+  if (s->config.key_order != AROCKS_KEYS_TYPED) {
+    // add 1 to len to account for null character in string key
+    *len = strlen(key) + 1;
+    return key;
+  }
+  b->len = 0;
+  key_codec_put_text(b, key);
+  *len = b->len;
+  return b->data;
+}
+
+char *arocks_key_text(const arocks_t *s, const char *data, size_t len) {
+  if (s->config.key_order != AROCKS_KEYS_TYPED) {
+    return strndup(data, len);
+  }
+  return key_codec_text(data, len);
+}
+
+int arocks_key_compare(const arocks_t *s, const char *a, size_t alen,
+                       const char *b, size_t blen) {
+  if (s->config.key_order == AROCKS_KEYS_NATURAL) {
+    return natural_compare(a, alen, b, blen);
+  }
+  int c = memcmp(a, b, alen < blen ? alen : blen);
+  return c != 0 ? c : (alen > blen) - (alen < blen);
+}
+
+/* Write a batch of the session's writes, through the group committer when
+ * there is one. */
+static void write_batch(arocks_t *s, rocksdb_writebatch_t *batch) {
+  if (s->committer != NULL) {
+    arocks_commit_write(s->committer, batch);
+    return;
+  }
+  char *err = NULL;
+  rocksdb_write(s->db, s->writeoptions, batch, &err);
+  ERR(err);
+}
+
+/* The lock for writes to key, NULL when there are no indexes to keep and
+ * writes needn't take turns. Locked on return. */
+static pthread_mutex_t *lock_key(arocks_t *s, const char *key) {
+  if (s->nindexes == 0) {
+    return NULL;
+  }
+  unsigned h = 2166136261u; // FNV-1a
+  for (const char *p = key; *p != '\0'; p++) {
+    h = (h ^ (unsigned char)*p) * 16777619u;
+  }
+  pthread_mutex_t *lock = &s->key_locks[h % AROCKS_KEY_STRIPES];
+  pthread_mutex_lock(lock);
+  return lock;
+}
+
+static void unlock_key(pthread_mutex_t *lock) {
+  if (lock != NULL) {
+    pthread_mutex_unlock(lock);
+  }
+}
+
+/* Write value, or doc when value is NULL. doc is value parsed, or NULL if
+ * it isn't a document. Objects and arrays are stored binary with
+ * config.binary_docs, and index entries go in the same batch. */
+static void put_value(arocks_t *s, const char *key, const char *value,
+                      const cJSON *doc) {
+  rocksdb_writebatch_t *batch = NULL;
+  if (s->nindexes > 0 || s->committer != NULL) {
+    batch = rocksdb_writebatch_create();
+    arocks_index_update(s, batch, key, doc);
+  }
+  char *stored = NULL;
+  size_t len = value != NULL ? strlen(value) + 1 : 0;
+  if (value == NULL || (s->config.binary_docs &&
+                        (cJSON_IsObject(doc) || cJSON_IsArray(doc)))) {
+    stored = arocks_doc_store(doc, s->config.binary_docs, &len);
+  }
+  key_buf_t kb;
+  key_buf_init(&kb);
+  size_t klen;
+  const char *k = arocks_key_encode(s, key, &kb, &klen);
+  if (batch != NULL) {
+    rocksdb_writebatch_put_cf(batch, s->cf, k, klen,
+                              stored != NULL ? stored : value, len);
+    write_batch(s, batch);
+    rocksdb_writebatch_destroy(batch);
+  } else {
+    arocks_insert_db(s->db, s->writeoptions, s->cf, NULL, k, klen,
+                     stored != NULL ? stored : value, len);
+  }
+  key_buf_free(&kb);
+  free(stored);
+}
+
+void arocks_put(arocks_t *s, const char *key, const char *value) {
+  uint64_t start = arocks_timer_start(s);
+  cJSON *doc = NULL;
+  if (s->nindexes > 0 || s->config.binary_docs) {
+    doc = arocks_doc_parse(value);
+  }
+  pthread_mutex_t *lock = lock_key(s, key);
+  put_value(s, key, value, doc);
+  unlock_key(lock);
+  cJSON_Delete(doc);
+  arocks_timer_stop(s, AROCKS_OP_PUT, start);
+}
+
+static const rocksdb_readoptions_t *
+read_options(const arocks_t *s, const arocks_snapshot_t *snap) {
+  return snap != NULL ? snap->readoptions : s->readoptions;
+}
+
+char *arocks_get(arocks_t *s, const char *key) {
+  return arocks_get_at(s, NULL, key);
+}
+
+char *arocks_get_at(arocks_t *s, const arocks_snapshot_t *snap,
+                    const char *key) {
+  key_buf_t kb;
+  key_buf_init(&kb);
+  size_t klen;
+  const char *k = arocks_key_encode(s, key, &kb, &klen);
+  uint64_t start = arocks_timer_start(s);
+  char *value =
+      arocks_select_db(s->db, read_options(s, snap), s->cf, k, klen);
+  arocks_timer_stop(s, AROCKS_OP_GET, start);
+  key_buf_free(&kb);
+  return value;
+}
+
+void arocks_delete(arocks_t *s, const char *key) {
+  char *err = NULL;
+  key_buf_t kb;
+  key_buf_init(&kb);
+  size_t klen;
+  const char *k = arocks_key_encode(s, key, &kb, &klen);
+  if (s->nindexes == 0 && s->committer == NULL) {
+    rocksdb_delete_cf(s->db, s->writeoptions, s->cf, k, klen, &err);
+  } else {
+    pthread_mutex_t *lock = lock_key(s, key);
+    rocksdb_writebatch_t *batch = rocksdb_writebatch_create();
+    arocks_index_update(s, batch, key, NULL);
+    rocksdb_writebatch_delete_cf(batch, s->cf, k, klen);
+    write_batch(s, batch);
+    rocksdb_writebatch_destroy(batch);
+    unlock_key(lock);
+  }
+  key_buf_free(&kb);
+  ERR(err);
+}
+
+/* Write operand for RocksDB to apply. An operand that changes an indexed
+ * field (indexed set) brings its index changes along in the same batch,
+ * worked out from the document it will produce. Indexed operands of a key
+ * run one at a time, so each sees the entries of the last; other operands
+ * can land in between without being lost, as they leave indexed fields
+ * alone. */
+static void merge_operand(arocks_t *s, const char *key, const char *operand,
+                          size_t len, int indexed) {
+  char *err = NULL;
+  key_buf_t kb;
+  key_buf_init(&kb);
+  size_t klen;
+  const char *k = arocks_key_encode(s, key, &kb, &klen);
+  uint64_t start = arocks_timer_start(s);
+  if (indexed) {
+    pthread_mutex_t *lock = lock_key(s, key);
+    cJSON *doc = arocks_merge_apply(arocks_get_doc(s, key), operand, len);
+    rocksdb_writebatch_t *batch = rocksdb_writebatch_create();
+    arocks_index_update(s, batch, key, doc);
+    rocksdb_writebatch_merge_cf(batch, s->cf, k, klen, operand, len);
+    write_batch(s, batch);
+    rocksdb_writebatch_destroy(batch);
+    unlock_key(lock);
+    cJSON_Delete(doc);
+  } else if (s->committer != NULL) {
+    rocksdb_writebatch_t *batch = rocksdb_writebatch_create();
+    rocksdb_writebatch_merge_cf(batch, s->cf, k, klen, operand, len);
+    write_batch(s, batch);
+    rocksdb_writebatch_destroy(batch);
+  } else {
+    rocksdb_merge_cf(s->db, s->writeoptions, s->cf, k, klen, operand, len,
+                     &err);
+  }
+  arocks_timer_stop(s, AROCKS_OP_MERGE, start);
+  key_buf_free(&kb);
+  ERR(err);
+}
+
+int arocks_merge(arocks_t *s, const char *key, const char *patch) {
+  // a bad operand would only surface later, on every read of the key
+  cJSON *doc = cJSON_Parse(patch);
+  if (doc == NULL) {
+    return -1;
+  }
+  int indexed = arocks_index_patch_touches(s, doc);
+  cJSON_Delete(doc);
+  merge_operand(s, key, patch, strlen(patch) + 1, indexed);
+  return 0;
+}
+
+int arocks_increment(arocks_t *s, const char *key, const char *path,
+                     double delta) {
+  if (path[0] == '\0' || (path[0] == ':' && path[1] == '\0')) {
+    return -1;
+  }
+  size_t len;
+  char *operand = arocks_increment_operand(path, delta, &len);
+  merge_operand(s, key, operand, len, arocks_index_path_touches(s, path));
+  cJSON_free(operand);
+  return 0;
+}
+
+typedef struct mget_key {
+  const char *key; // stored form
+  size_t len;
+  size_t idx; // position in the caller's arrays
+} mget_key;
+
+// bytewise, which is the order of text and typed keys alike
+static int mget_key_cmp(const void *a, const void *b) {
+  const mget_key *x = a;
+  const mget_key *y = b;
+  int c = memcmp(x->key, y->key, x->len < y->len ? x->len : y->len);
+  return c != 0 ? c : (x->len > y->len) - (x->len < y->len);
+}
+
+/* Pinned lookup of a key in its stored form. */
+static rocksdb_pinnableslice_t *get_pinned(arocks_t *s,
+                                           const rocksdb_readoptions_t *ro,
+                                           const char *key) {
+  char *err = NULL;
+  key_buf_t kb;
+  key_buf_init(&kb);
+  size_t klen;
+  const char *k = arocks_key_encode(s, key, &kb, &klen);
+  uint64_t start = arocks_timer_start(s);
+  rocksdb_pinnableslice_t *pin =
+      rocksdb_get_pinned_cf(s->db, ro, s->cf, k, klen, &err);
+  arocks_timer_stop(s, AROCKS_OP_GET, start);
+  key_buf_free(&kb);
+  ERR(err);
+  return pin;
+}
+
+static void view_from_pin(arocks_view_t *view, rocksdb_pinnableslice_t *pin) {
+  view->pin = pin;
+  view->text = NULL;
+  if (pin == NULL) {
+    view->data = NULL;
+    view->len = 0;
+    return;
+  }
+  view->data = rocksdb_pinnableslice_value(pin, &view->len);
+  if (arocks_doc_is_binary(view->data, view->len)) {
+    // the text is all the caller needs, so the pin can go right away
+    view->text = arocks_doc_text(view->data, view->len);
+    rocksdb_pinnableslice_destroy(pin);
+    view->pin = NULL;
+    view->data = view->text;
+    view->len = strlen(view->text);
+    return;
+  }
+  if (view->len > 0 && view->data[view->len - 1] == '\0') {
+    view->len--;
+  }
+}
+
+int arocks_get_pinned(arocks_t *s, const char *key, arocks_view_t *view) {
+  return arocks_get_pinned_at(s, NULL, key, view);
+}
+
+int arocks_get_pinned_at(arocks_t *s, const arocks_snapshot_t *snap,
+                         const char *key, arocks_view_t *view) {
+  rocksdb_pinnableslice_t *pin = get_pinned(s, read_options(s, snap), key);
+  view_from_pin(view, pin);
+  return pin != NULL;
+}
+
+cJSON *arocks_get_doc(arocks_t *s, const char *key) {
+  rocksdb_pinnableslice_t *pin = get_pinned(s, s->readoptions, key);
+  if (pin == NULL) {
+    return NULL;
+  }
+  size_t len;
+  const char *data = rocksdb_pinnableslice_value(pin, &len);
+  cJSON *doc = arocks_doc_load(data, len);
+  rocksdb_pinnableslice_destroy(pin);
+  return doc;
+}
+
+void arocks_release(arocks_view_t *view) {
+  if (view->pin != NULL) {
+    rocksdb_pinnableslice_destroy(view->pin);
+  }
+  free(view->text);
+  view->text = NULL;
+  view->pin = NULL;
+  view->data = NULL;
+  view->len = 0;
+}
+
+/*
+** Keys are sorted before the lookup so RocksDB can batch the block reads and
+** bloom checks for neighbouring keys, then results go back in caller order.
+** Natural order isn't bytewise, RocksDB sorts those keys itself.
+*/
+void arocks_multi_get_pinned(arocks_t *s, size_t n, const char *const keys[],
+                             arocks_view_t views[]) {
+  arocks_multi_get_pinned_at(s, NULL, n, keys, views);
+}
+
+void arocks_multi_get_pinned_at(arocks_t *s, const arocks_snapshot_t *snap,
+                                size_t n, const char *const keys[],
+                                arocks_view_t views[]) {
+  if (n == 0) {
+    return;
+  }
+  mget_key *order = malloc(n * sizeof(mget_key));
+  key_buf_t *encoded = malloc(n * sizeof(key_buf_t));
+  for (size_t i = 0; i < n; i++) {
+    key_buf_init(&encoded[i]);
+    order[i].key = arocks_key_encode(s, keys[i], &encoded[i], &order[i].len);
+    order[i].idx = i;
+  }
+  int bytewise = s->config.key_order != AROCKS_KEYS_NATURAL;
+  if (bytewise) {
+    qsort(order, n, sizeof(mget_key), mget_key_cmp);
+  }
+
+  const char **sorted = malloc(n * sizeof(char *));
+  size_t *sizes = malloc(n * sizeof(size_t));
+  rocksdb_pinnableslice_t **values = malloc(n * sizeof(void *));
+  char **errs = malloc(n * sizeof(char *));
+  for (size_t i = 0; i < n; i++) {
+    sorted[i] = order[i].key;
+    sizes[i] = order[i].len;
+  }
+
+  uint64_t start = arocks_timer_start(s);
+  rocksdb_batched_multi_get_cf(s->db, read_options(s, snap), s->cf, n, sorted,
+                               sizes, values, errs, (unsigned char)bytewise);
+  arocks_timer_stop(s, AROCKS_OP_MULTIGET, start);
+
+  for (size_t i = 0; i < n; i++) {
+    ERR(errs[i]);
+    view_from_pin(&views[order[i].idx], values[i]);
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    key_buf_free(&encoded[i]);
+  }
+  free(encoded);
+  free(order);
+  free(sorted);
+  free(sizes);
+  free(values);
+  free(errs);
+}
+
+void arocks_multi_get(arocks_t *s, size_t n, const char *const keys[],
+                      char *vals[]) {
+  arocks_view_t *views = malloc(n * sizeof(arocks_view_t));
+  arocks_multi_get_pinned(s, n, keys, views);
+  for (size_t i = 0; i < n; i++) {
+    vals[i] = NULL;
+    if (views[i].data != NULL) {
+      vals[i] = malloc(views[i].len + 1);
+      memcpy(vals[i], views[i].data, views[i].len);
+      vals[i][views[i].len] = '\0';
+      arocks_release(&views[i]);
+    }
+  }
+  free(views);
+}
+
+static size_t text_len(const char *data, size_t len) {
+  return len > 0 && data[len - 1] == '\0' ? len - 1 : len;
+}
+
+static void scan_stats(rocksdb_perfcontext_t *perf,
+                       arocks_scan_stats_t *stats) {
+  uint64_t hits = rocksdb_perfcontext_metric(perf, rocksdb_bloom_sst_hit_count);
+  stats->sst_files_skipped =
+      rocksdb_perfcontext_metric(perf, rocksdb_bloom_sst_miss_count);
+  stats->sst_files_checked = hits + stats->sst_files_skipped;
+  stats->memtable_skipped =
+      rocksdb_perfcontext_metric(perf, rocksdb_bloom_memtable_miss_count);
+  stats->blocks_read =
+      rocksdb_perfcontext_metric(perf, rocksdb_block_read_count);
+  stats->blocks_cached =
+      rocksdb_perfcontext_metric(perf, rocksdb_block_cache_hit_count);
+}
+
+/* A scan bound in its stored form. Text bounds leave out the '\0', so
+ * "ab" starts (or ends) a scan before "ab" itself and everything after. */
+static const char *scan_bound(const arocks_t *s, const char *key,
+                              key_buf_t *b, size_t *len) {
+  const char *k = arocks_key_encode(s, key, b, len);
+  if (s->config.key_order != AROCKS_KEYS_TYPED) {
+    (*len)--;
+  }
+  return k;
+}
+
+long arocks_scan_each(arocks_t *s, const arocks_scan_opts_t *opts,
+                      arocks_visit_fn fn, void *ctx) {
+  int typed = s->config.key_order == AROCKS_KEYS_TYPED;
+  key_buf_t end_buf, start_buf;
+  key_buf_init(&end_buf);
+  key_buf_init(&start_buf);
+  size_t len;
+  rocksdb_readoptions_t *readoptions = rocksdb_readoptions_create();
+  // keys past the bound are never read, not just skipped
+  if (opts->end != NULL) {
+    const char *end = scan_bound(s, opts->end, &end_buf, &len);
+    rocksdb_readoptions_set_iterate_upper_bound(readoptions, end, len);
+  } else {
+    rocksdb_readoptions_set_iterate_upper_bound(
+        readoptions, AROCKS_SYS_PREFIX, strlen(AROCKS_SYS_PREFIX));
+  }
+  if (opts->prefix) {
+    // lets the prefix bloom filters skip SST files without the prefix
+    rocksdb_readoptions_set_prefix_same_as_start(readoptions, 1);
+  } else {
+    // with a prefix extractor, iterators otherwise stay in prefix mode and
+    // may skip or end early at keys with other prefixes
+    rocksdb_readoptions_set_total_order_seek(readoptions, 1);
+  }
+  if (opts->snapshot != NULL) {
+    rocksdb_readoptions_set_snapshot(readoptions, opts->snapshot->snap);
+  }
+  if (fn == NULL) {
+    // a count walks blocks no reader asked for, keep the cache for those
+    rocksdb_readoptions_set_fill_cache(readoptions, 0);
+  }
+  // the perf context is per thread, so it's picked up for each scan
+  rocksdb_perfcontext_t *perf = NULL;
+  if (opts->stats != NULL) {
+    rocksdb_set_perf_level(rocksdb_enable_count);
+    perf = rocksdb_perfcontext_create();
+    rocksdb_perfcontext_reset(perf);
+  }
+  uint64_t start = arocks_timer_start(s);
+  rocksdb_iterator_t *iter =
+      rocksdb_create_iterator_cf(s->db, readoptions, s->cf);
+  // an empty start key means no start key, in either direction
+  int has_start = opts->start != NULL && opts->start[0] != '\0';
+  if (opts->reverse && has_start) {
+    // include start itself, stored keys carry their '\0'
+    const char *k = arocks_key_encode(s, opts->start, &start_buf, &len);
+    rocksdb_iter_seek_for_prev(iter, k, len);
+  } else if (opts->reverse) {
+    rocksdb_iter_seek_to_last(iter);
+  } else if (has_start) {
+    const char *k = scan_bound(s, opts->start, &start_buf, &len);
+    rocksdb_iter_seek(iter, k, len);
+  } else {
+    rocksdb_iter_seek_to_first(iter);
+  }
+  arocks_timer_stop(s, AROCKS_OP_SEEK, start);
+
+  long n = 0;
+  size_t klen;
+  size_t vlen;
+  while ((opts->limit <= 0 || n < opts->limit) && rocksdb_iter_valid(iter)) {
+    n++;
+    if (fn != NULL) {
+      const char *key = rocksdb_iter_key(iter, &klen);
+      const char *val = NULL;
+      char *text = NULL;
+      vlen = 0;
+      if (!opts->keys_only) {
+        val = rocksdb_iter_value(iter, &vlen);
+        if (arocks_doc_is_binary(val, vlen)) {
+          if (!opts->raw) {
+            text = arocks_doc_text(val, vlen);
+            val = text;
+            vlen = strlen(text);
+          }
+        } else {
+          vlen = text_len(val, vlen);
+        }
+      }
+      char *key_text = typed ? arocks_key_text(s, key, klen) : NULL;
+      int stop = key_text != NULL
+                     ? fn(key_text, strlen(key_text), val, vlen, ctx)
+                     : fn(key, text_len(key, klen), val, vlen, ctx);
+      free(key_text);
+      free(text);
+      if (stop != 0) {
+        break;
+      }
+    }
+    start = arocks_timer_start(s);
+    if (opts->reverse) {
+      rocksdb_iter_prev(iter);
+    } else {
+      rocksdb_iter_next(iter);
+    }
+    arocks_timer_stop(s, AROCKS_OP_NEXT, start);
+  }
+
   char *err = NULL;
-  rocksdb_t *db = rocksdb_open(options, db_path, &err);
+  rocksdb_iter_get_error(iter, &err);
   ERR(err);
-  return db;
+  rocksdb_iter_destroy(iter);
+  rocksdb_readoptions_destroy(readoptions);
+  key_buf_free(&end_buf);
+  key_buf_free(&start_buf);
+  if (opts->stats != NULL) {
+    scan_stats(perf, opts->stats);
+    rocksdb_perfcontext_destroy(perf);
+    rocksdb_set_perf_level(rocksdb_disable);
+  }
+  return n;
 }
 
+/* Bytes of SST data between two stored keys (end NULL for all of them,
+ * system keys included). */
+static uint64_t sst_bytes(arocks_t *s, const char *start, size_t slen,
+                          const char *end, size_t elen) {
+  // above every key, the system ones included
+  static const char last[] = "\xff\xff\xff\xff\xff\xff\xff\xff";
+  if (end == NULL) {
+    end = last;
+    elen = sizeof(last) - 1;
+  }
+  uint64_t size = 0;
+  char *err = NULL;
+  rocksdb_approximate_sizes_cf(s->db, s->cf, 1, &start, &slen, &end, &elen,
+                               &size, &err);
+  ERR(err);
+  return size;
+}
+
+uint64_t arocks_estimate_count(arocks_t *s, const char *start,
+                               const char *end, uint64_t *bytes) {
+  key_buf_t end_buf, start_buf;
+  key_buf_init(&end_buf);
+  key_buf_init(&start_buf);
+  size_t elen = strlen(AROCKS_SYS_PREFIX);
+  size_t slen = 0;
+  const char *e = AROCKS_SYS_PREFIX;
+  const char *k = "";
+  if (end != NULL) {
+    e = scan_bound(s, end, &end_buf, &elen);
+  }
+  if (start != NULL && start[0] != '\0') {
+    k = scan_bound(s, start, &start_buf, &slen);
+  }
+  uint64_t keys = 0;
+  rocksdb_property_int_cf(s->db, s->cf, "rocksdb.estimate-num-keys", &keys);
+  uint64_t all = sst_bytes(s, "", 0, NULL, 0);
+  uint64_t range = sst_bytes(s, k, slen, e, elen);
+  key_buf_free(&end_buf);
+  key_buf_free(&start_buf);
+  if (bytes != NULL) {
+    *bytes = range;
+  }
+  if (all == 0) {
+    // nothing flushed to apportion by, and at most a memtable to count
+    arocks_scan_opts_t opts = {start, end};
+    return (uint64_t)arocks_scan_each(s, &opts, NULL, NULL);
+  }
+  // index entries are keys too, so the share is of every key
+  return range >= all ? keys : (uint64_t)((double)keys * range / all + 0.5);
+}
+
+/*
+** Compaction
+*/
+
+void arocks_compact(arocks_t *s) {
+  char *err = NULL;
+  rocksdb_flushoptions_t *flushoptions = rocksdb_flushoptions_create();
+  rocksdb_flushoptions_set_wait(flushoptions, 1);
+  rocksdb_flush_cf(s->db, flushoptions, s->cf, &err);
+  ERR(err);
+  rocksdb_flushoptions_destroy(flushoptions);
+  rocksdb_compactoptions_t *compactoptions = rocksdb_compactoptions_create();
+  // kForce: the last level is rewritten too, which is where GC gets to run
+  rocksdb_compactoptions_set_bottommost_level_compaction(compactoptions, 2);
+  rocksdb_compact_range_cf_opt(s->db, s->cf, compactoptions, NULL, 0, NULL,
+                               0);
+  rocksdb_compactoptions_destroy(compactoptions);
+}
+
+/*
+** Snapshots
+*/
+
+arocks_snapshot_t *arocks_snapshot(arocks_t *s, const void *owner) {
+  arocks_snapshot_t *snap = malloc(sizeof(arocks_snapshot_t));
+  snap->snap = rocksdb_create_snapshot(s->db);
+  snap->readoptions = rocksdb_readoptions_create();
+  rocksdb_readoptions_set_snapshot(snap->readoptions, snap->snap);
+  snap->taken_ns = arocks_now_ns();
+  snap->owner = owner;
+  pthread_mutex_lock(&s->snapshots_lock);
+  snap->id = ++s->snapshot_ids;
+  snap->next = s->snapshots;
+  s->snapshots = snap;
+  pthread_mutex_unlock(&s->snapshots_lock);
+  return snap;
+}
+
+static void snapshot_free(arocks_t *s, arocks_snapshot_t *snap) {
+  rocksdb_readoptions_destroy(snap->readoptions);
+  rocksdb_release_snapshot(s->db, snap->snap);
+  free(snap);
+}
+
+void arocks_snapshot_release(arocks_t *s, arocks_snapshot_t *snap) {
+  pthread_mutex_lock(&s->snapshots_lock);
+  arocks_snapshot_t **p = &s->snapshots;
+  while (*p != NULL && *p != snap) {
+    p = &(*p)->next;
+  }
+  if (*p != NULL) {
+    *p = snap->next;
+  }
+  pthread_mutex_unlock(&s->snapshots_lock);
+  snapshot_free(s, snap);
+}
+
+arocks_snapshot_t *arocks_snapshot_find(arocks_t *s, uint64_t id,
+                                        const void *owner) {
+  pthread_mutex_lock(&s->snapshots_lock);
+  arocks_snapshot_t *snap = s->snapshots;
+  while (snap != NULL && (snap->id != id || snap->owner != owner)) {
+    snap = snap->next;
+  }
+  pthread_mutex_unlock(&s->snapshots_lock);
+  return snap;
+}
+
+int arocks_snapshot_release_owned(arocks_t *s, const void *owner) {
+  arocks_snapshot_t *owned = NULL;
+  pthread_mutex_lock(&s->snapshots_lock);
+  arocks_snapshot_t **p = &s->snapshots;
+  while (*p != NULL) {
+    arocks_snapshot_t *snap = *p;
+    if (snap->owner == owner) {
+      *p = snap->next;
+      snap->next = owned;
+      owned = snap;
+    } else {
+      p = &snap->next;
+    }
+  }
+  pthread_mutex_unlock(&s->snapshots_lock);
+  int n = 0;
+  while (owned != NULL) {
+    arocks_snapshot_t *next = owned->next;
+    snapshot_free(s, owned);
+    owned = next;
+    n++;
+  }
+  return n;
+}
+
+int arocks_snapshot_count(arocks_t *s, double *oldest_sec) {
+  uint64_t now = arocks_now_ns();
+  int n = 0;
+  *oldest_sec = 0;
+  pthread_mutex_lock(&s->snapshots_lock);
+  for (arocks_snapshot_t *snap = s->snapshots; snap != NULL;
+       snap = snap->next) {
+    double age = (now - snap->taken_ns) / 1e9;
+    *oldest_sec = age > *oldest_sec ? age : *oldest_sec;
+    n++;
+  }
+  pthread_mutex_unlock(&s->snapshots_lock);
+  return n;
+}
+
+void arocks_snapshot_report(arocks_t *s, double min_sec, FILE *out) {
+  uint64_t now = arocks_now_ns();
+  pthread_mutex_lock(&s->snapshots_lock);
+  for (arocks_snapshot_t *snap = s->snapshots; snap != NULL;
+       snap = snap->next) {
+    double age = (now - snap->taken_ns) / 1e9;
+    if (age > min_sec) {
+      fprintf(out, "snapshot %llu held %.1fs\n", (unsigned long long)snap->id,
+              age);
+    }
+  }
+  pthread_mutex_unlock(&s->snapshots_lock);
+}
+
+/*
+** Statistics
+*/
+
+/* The number after field on name's line of the statistics dump, which has
+ * one line per ticker, "rocksdb.block.cache.hit COUNT : 42", and per
+ * histogram, "rocksdb.db.get.micros P50 : 1.0 ... COUNT : 3 SUM : 6". */
+static uint64_t statistic(arocks_t *s, const char *name, const char *field) {
+  if (!s->config.statistics) {
+    return 0;
+  }
+  char *text = rocksdb_options_statistics_get_string(s->options);
+  uint64_t value = 0;
+  size_t len = strlen(name);
+  char *line = text;
+  while (line != NULL && *line != '\0') {
+    char *next = strchr(line, '\n');
+    if (strncmp(line, name, len) == 0 && line[len] == ' ') {
+      char *at = strstr(line + len, field);
+      if (at != NULL && (next == NULL || at < next)) {
+        value = strtoull(at + strlen(field), NULL, 10);
+      }
+      break;
+    }
+    line = next == NULL ? NULL : next + 1;
+  }
+  rocksdb_free(text);
+  return value;
+}
+
+uint64_t arocks_ticker(arocks_t *s, const char *name) {
+  return statistic(s, name, " COUNT : ");
+}
+
+uint64_t arocks_histogram_sum(arocks_t *s, const char *name) {
+  return statistic(s, name, " SUM : ");
+}
+
+void arocks_cache_stats(arocks_t *s, arocks_cache_stats_t *stats) {
+  pthread_mutex_lock(&shared_cache_lock);
+  stats->capacity = rocksdb_cache_get_capacity(shared_cache);
+  stats->usage = rocksdb_cache_get_usage(shared_cache);
+  stats->pinned = rocksdb_cache_get_pinned_usage(shared_cache);
+  pthread_mutex_unlock(&shared_cache_lock);
+  stats->hits = arocks_ticker(s, "rocksdb.block.cache.hit");
+  stats->misses = arocks_ticker(s, "rocksdb.block.cache.miss");
+  stats->index_hits = arocks_ticker(s, "rocksdb.block.cache.index.hit");
+  stats->filter_hits = arocks_ticker(s, "rocksdb.block.cache.filter.hit");
+  stats->data_hits = arocks_ticker(s, "rocksdb.block.cache.data.hit");
+}
+
+/*
+** One-shot helpers
+*/
+
 void arocks_insert(char *db_path, char *key, char *value) {
-  rocksdb_t *db;
-  rocksdb_options_t *options = rocksdb_options_create();
-  db = arocks_init(db_path, options);
-  arocks_insert_db(db, key, value);
-  rocksdb_close(db);
-  rocksdb_options_destroy(options);
+  arocks_t *s = arocks_open(db_path);
+  arocks_put(s, key, value);
+  arocks_close(s);
 }
 
 char *arocks_select(char *db_path, char *key) {
-  rocksdb_t *db;
-  rocksdb_options_t *options = rocksdb_options_create();
-  db = arocks_init(db_path, options);
-  char *ret = arocks_select_db(db, key);
-  rocksdb_close(db);
-  rocksdb_options_destroy(options);
+  arocks_t *s = arocks_open(db_path);
+  char *ret = arocks_get(s, key);
+  arocks_close(s);
   return ret;
 }
 
-int arocks_iter(char *db_path, char *key, int count, char *keys[], char *vals[]) {
-  rocksdb_t *db;
-  rocksdb_options_t *options = rocksdb_options_create();
-  db = arocks_init(db_path, options);
+static int print_entry(const char *key, size_t klen, const char *val,
+                       size_t vlen, void *ctx) {
+  printf("%.*s = %.*s\n", (int)klen, key, (int)vlen, val);
+  return 0;
+}
+
+/* Typed keys: distinct texts must encode apart, and each must read back
+ * as itself. Returns the number of failures. */
+static int check_typed_keys(void) {
+  const char *texts[] = {"2024-01-01", "2024-02-15", "2024",      "nullable",
+                         "null",       "true_story", "true",      "42abc",
+                         "42",         "[\"acme\",7]x", "[\"acme\",7]",
+                         "1e400",      "-7.5",       "acme"};
+  size_t n = sizeof(texts) / sizeof(texts[0]);
+  key_buf_t *keys = malloc(n * sizeof(key_buf_t));
+  int failed = 0;
+  for (size_t i = 0; i < n; i++) {
+    key_buf_init(&keys[i]);
+    key_codec_put_text(&keys[i], texts[i]);
+    char *text = key_codec_text(keys[i].data, keys[i].len);
+    if (strcmp(text, texts[i]) != 0) {
+      printf("typed key %s reads back as %s\n", texts[i], text);
+      failed++;
+    }
+    free(text);
+    for (size_t j = 0; j < i; j++) {
+      if (keys[i].len == keys[j].len &&
+          memcmp(keys[i].data, keys[j].data, keys[i].len) == 0) {
+        printf("typed keys %s and %s collide\n", texts[i], texts[j]);
+        failed++;
+      }
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    key_buf_free(&keys[i]);
+  }
+  free(keys);
+  return failed;
+}
+
+/* Scans that aren't prefix scans cross prefixes, even with the scan-heavy
+ * preset's prefix extractor. Returns the number of failures. */
+static int check_cross_prefix_scans(const char *db_path) {
+  arocks_config_t cfg = arocks_config_defaults();
+  if (arocks_profile_load(&cfg, "profiles.edn", "scan-heavy") != 0) {
+    return 1;
+  }
+  arocks_t *s = arocks_open_with(db_path, &cfg);
+  const char *keys[] = {"acme:doc:1", "acme:doc:2", "beta:doc:1",
+                        "beta:doc:2"};
+  for (int i = 0; i < 4; i++) {
+    arocks_put(s, keys[i], "{}");
+  }
+  int failed = 0;
+  arocks_scan_opts_t forward = {"acme:doc:", NULL, 10, 0};
+  arocks_scan_opts_t reverse = {"beta:doc:2", NULL, 10, 1};
+  arocks_scan_opts_t ranged = {"acme:doc:2", "beta:doc:2", 0, 0};
+  arocks_scan_opts_t prefixed = {"acme:doc:", NULL, 10, 0, 1};
+  long n;
+  if ((n = arocks_scan_each(s, &forward, NULL, NULL)) != 4) {
+    printf("forward scan across prefixes visited %ld of 4\n", n);
+    failed++;
+  }
+  if ((n = arocks_scan_each(s, &reverse, NULL, NULL)) != 4) {
+    printf("reverse scan across prefixes visited %ld of 4\n", n);
+    failed++;
+  }
+  if ((n = arocks_scan_each(s, &ranged, NULL, NULL)) != 2) {
+    printf("ranged scan across prefixes visited %ld of 2\n", n);
+    failed++;
+  }
+  if ((n = arocks_scan_each(s, &prefixed, NULL, NULL)) != 2) {
+    printf("prefix scan visited %ld of 2\n", n);
+    failed++;
+  }
+  arocks_close(s);
+  return failed;
+}
+
+typedef struct index_writer {
+  arocks_t *s;
+  int id;
+} index_writer;
+
+static void *write_indexed(void *arg) {
+  index_writer *w = arg;
+  char value[32];
+  for (int i = 0; i < 500; i++) {
+    if (w->id % 2 == 0) {
+      snprintf(value, sizeof(value), "{\"n\":%d}", w->id * 1000 + i);
+      arocks_put(w->s, "contested", value);
+    } else {
+      arocks_increment(w->s, "contested", ":n", 1);
+    }
+  }
+  return NULL;
+}
+
+/* Half the writers increment the indexed :n, half the unindexed :views. */
+static void *merge_counters(void *arg) {
+  index_writer *w = arg;
+  for (int i = 0; i < 500; i++) {
+    arocks_increment(w->s, "counted", w->id % 2 == 0 ? ":n" : ":views", 1);
+  }
+  return NULL;
+}
+
+/* Index entries stored, stale ones included. */
+static long index_entries(arocks_t *s) {
+  const char *lower = AROCKS_INDEX_ENTRY;
+  char *upper = strdup(lower);
+  upper[strlen(upper) - 1] = ';'; // past every "idx:" key
   rocksdb_readoptions_t *readoptions = rocksdb_readoptions_create();
-  rocksdb_iterator_t *iter = rocksdb_create_iterator(db, readoptions);
-  rocksdb_iter_seek(iter, key, strlen(key));
-  int i = 0;
-  size_t klen;
-  size_t vlen;
-  while(i < count && rocksdb_iter_valid(iter)) {
-    const char *ret_key = rocksdb_iter_key(iter, &klen);
-    const char *ret_val = rocksdb_iter_value(iter, &vlen);
-    // copy into result pointers
-    keys[i] = malloc(klen * sizeof(char));
-    strncpy(keys[i], ret_key, klen);
-    // copy into result pointers
-    vals[i] = malloc(vlen * sizeof(char));
-    strncpy(vals[i], ret_val, vlen);
-    // move on
-    rocksdb_iter_next(iter);
-    i++;
-  }
-  return i;
+  rocksdb_readoptions_set_iterate_upper_bound(readoptions, upper,
+                                              strlen(upper));
+  rocksdb_readoptions_set_total_order_seek(readoptions, 1);
+  rocksdb_iterator_t *iter =
+      rocksdb_create_iterator_cf(s->db, readoptions, s->cf);
+  long n = 0;
+  for (rocksdb_iter_seek(iter, lower, strlen(lower)); rocksdb_iter_valid(iter);
+       rocksdb_iter_next(iter)) {
+    n++;
+  }
+  rocksdb_iter_destroy(iter);
+  rocksdb_readoptions_destroy(readoptions);
+  free(upper);
+  return n;
+}
+
+static void run_writers(arocks_t *s, void *(*fn)(void *)) {
+  pthread_t threads[8];
+  index_writer writers[8];
+  for (int i = 0; i < 8; i++) {
+    writers[i].s = s;
+    writers[i].id = i;
+    pthread_create(&threads[i], NULL, fn, &writers[i]);
+  }
+  for (int i = 0; i < 8; i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+/* Concurrent puts and indexed increments of one key leave it exactly one
+ * index entry, and concurrent indexed and unindexed increments of another
+ * lose none. Returns the number of failures. */
+static int check_concurrent_index(const char *db_path) {
+  int failures = 0;
+  arocks_t *s = arocks_open(db_path);
+  arocks_delete(s, "contested");
+  arocks_delete(s, "counted");
+  arocks_index_create(s, ":n");
+  run_writers(s, write_indexed);
+  long n = index_entries(s);
+  if (n != 1) {
+    printf("one indexed document has %ld index entries\n", n);
+    failures++;
+  }
+  run_writers(s, merge_counters);
+  cJSON *doc = arocks_get_doc(s, "counted");
+  const cJSON *indexed = json_path_get(doc, ":n");
+  const cJSON *unindexed = json_path_get(doc, ":views");
+  if (!cJSON_IsNumber(indexed) || indexed->valuedouble != 2000 ||
+      !cJSON_IsNumber(unindexed) || unindexed->valuedouble != 2000) {
+    char *text = cJSON_PrintUnformatted(doc);
+    printf("2000 increments of each counter left %s\n", text);
+    free(text);
+    failures++;
+  }
+  cJSON_Delete(doc);
+  arocks_close(s);
+  return failures;
 }
 
 void alvarez_rocks(void) {
+  printf("typed keys: %s\n", check_typed_keys() == 0 ? "ok" : "FAILED");
+  printf("cross-prefix scans: %s\n",
+         check_cross_prefix_scans(".data-scan") == 0 ? "ok" : "FAILED");
+  printf("concurrent indexed writes: %s\n",
+         check_concurrent_index(".data-index") == 0 ? "ok" : "FAILED");
+
   // Put key-value
   char *db_path = ".data";
   char *key = "few";
   char *value = "bar";
 
-  arocks_insert(db_path, key, value);
-  char *ret = arocks_select(db_path, key);
+  // open once, run everything against the same session
+  arocks_t *s = arocks_open(db_path);
+
+  arocks_put(s, key, value);
+  char *ret = arocks_get(s, key);
   printf("cool: %s\n", ret);
   free(ret);
 
-  arocks_insert(db_path, "wild", "stallion");
-  ret = arocks_select(db_path, "wild");
+  arocks_put(s, "wild", "stallion");
+  ret = arocks_get(s, "wild");
   printf("cool: %s\n", ret);
   free(ret);
 
-  arocks_insert(db_path, "cool", "dude");
-  arocks_insert(db_path, "rad", "hombre");
-  arocks_insert(db_path, "silly", "man");
+  arocks_put(s, "cool", "dude");
+  arocks_put(s, "rad", "hombre");
+  arocks_put(s, "silly", "man");
 
-  int db_count = 5;
-  char *keys[db_count];
-  char *vals[db_count];
-  int n = arocks_iter(db_path, "cool", db_count, keys, vals);
-  if (n == 0) {
+  arocks_scan_opts_t opts = {"cool", NULL, 5, 0};
+  if (arocks_scan_each(s, &opts, print_entry, NULL) == 0) {
     printf("key not found\n");
-  } else {
-    for (int i = 0; i < n; i++) {
-      printf("%s = %s\n", keys[i], vals[i]);
-      free(keys[i]);
-      free(vals[i]);
-    }
   }
+
+  arocks_close(s);
 }
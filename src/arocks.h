@@ -1,9 +1,358 @@
 #ifndef ALVAREZ_ROCKS_H_
 #define ALVAREZ_ROCKS_H_
 
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cJSON.h"
+#include "key_codec.h"
+#include "rocksdb/c.h"
+
+#define ERR(err)                                                               \
+  if (err) {                                                                   \
+    fprintf(stderr, "Error: %s\n", err);                                       \
+    abort();                                                                   \
+  }
+
+/* Prefix extractors, see arocks_config_t.prefix_type */
+#define AROCKS_PREFIX_NONE 0
+#define AROCKS_PREFIX_FIXED 1  // first prefix_len bytes, shorter keys have none
+#define AROCKS_PREFIX_CAPPED 2 // first prefix_len bytes, or the whole key
+#define AROCKS_PREFIX_DELIM 3  // through the prefix_len-th prefix_delim
+
+/* Block cache types, see arocks_config_t.cache_type */
+#define AROCKS_CACHE_LRU 0
+#define AROCKS_CACHE_HYPER_CLOCK 1
+
+/* Compaction styles, see arocks_config_t.compaction_style */
+#define AROCKS_COMPACTION_LEVEL 0
+#define AROCKS_COMPACTION_UNIVERSAL 1
+#define AROCKS_COMPACTION_FIFO 2
+
+/* Key orders, see arocks_config_t.key_order */
+#define AROCKS_KEYS_BYTES 0   // text keys, bytewise
+#define AROCKS_KEYS_NATURAL 1 // text keys, digit runs by value ("a9" < "a10")
+#define AROCKS_KEYS_TYPED 2   // keys read as JSON values, see key_codec.h
+
+#define AROCKS_MAX_LEVELS 8
+
+/*
+** Tuning applied by arocks_init before the DB is opened. Start from
+** arocks_config_defaults() and change what you need. The prefix extractor
+** has to be the same every time a DB is opened for its filters to be used,
+** and the key order for its keys to be found at all.
+*/
+typedef struct arocks_config {
+  // 0 leaves a setting to RocksDB, as tuned by the compaction style: level
+  // and universal start from RocksDB's Optimize*StyleCompaction, given a
+  // memtable budget of 4 write buffers (512MB when write_buffer_size is 0)
+  // and picking memtable, L0, file and level sizes and compression from it
+  int parallelism;             // background threads, 0 for one per CPU
+  int max_background_jobs;
+  size_t write_buffer_size;    // memtable size
+  int max_write_buffer_number;
+  int compaction_style;
+  uint64_t fifo_max_bytes; // FIFO drops the oldest files past this, 0: 1GB
+  int num_levels;
+  uint64_t target_file_size_base;
+  uint64_t max_bytes_for_level_base;
+  int level0_compaction_trigger;
+  int disable_auto_compactions; // for bulk loads, compact once at the end
+  size_t block_size;
+  // compression type (rocksdb_*_compression) for each of the first
+  // compression_levels levels, the last one also covers deeper levels
+  int compression[AROCKS_MAX_LEVELS];
+  int compression_levels;
+  // zstd dictionary per SST file (see arocks_dict.h), 0 for none. Levels
+  // default to zstd with a dictionary; training samples default to 100x
+  // the dictionary size.
+  int zstd_dict_bytes;
+  int zstd_train_bytes;
+  // key-value separation: values of min_blob_size bytes or more go to blob
+  // files and SSTs keep a reference, so compactions move the reference
+  // instead of rewriting the value. GC relocates the blobs still live in
+  // the oldest blob_gc_age_cutoff of blob files as compaction reaches them.
+  int blob_files;
+  uint64_t min_blob_size;
+  uint64_t blob_file_size;
+  int blob_compression; // rocksdb_*_compression
+  int blob_gc;
+  double blob_gc_age_cutoff;
+  int prefix_type;
+  int prefix_len;
+  char prefix_delim;
+  int bloom_bits;              // bloom filter bits per key, 0 turns them off
+  int whole_key_filtering;     // filter whole keys too, for point lookups
+  double memtable_bloom_ratio; // memtable prefix bloom size, 0 for none
+  // the block cache is shared by every session in the process, the first
+  // session to open sizes it
+  size_t cache_size;
+  int cache_type;
+  int cache_index_and_filter_blocks; // charge index/filter blocks to cache
+  int pin_l0_filter_and_index_blocks; // ... but keep L0's pinned there
+  int statistics; // collect RocksDB tickers and arocks latency histograms
+  int binary_docs; // store JSON/EDN documents binary encoded (arocks_doc.h)
+  int key_order;   // AROCKS_KEYS_*, the same for every column family
+  // seconds: FIFO compaction drops files older than this, level and
+  // universal compaction rewrite them (clearing out deletes), 0 for never
+  uint64_t ttl;
+  // namespace (column family) the session works in, NULL for the default
+  const char *column_family;
+  // sync the WAL before a write returns. group_commit has a committer
+  // thread share each sync among the writes queued meanwhile (see
+  // arocks_commit.h), closing a group at group_commit_bytes or
+  // group_commit_delay_us after its first write
+  int sync_writes;
+  int group_commit;
+  size_t group_commit_bytes;
+  uint64_t group_commit_delay_us;
+  // open the DB for optimistic transactions (see arocks_txn.h), which
+  // arocks_txn_run retries up to txn_retries times on a conflict
+  int transactions;
+  int txn_retries;
+} arocks_config_t;
+
+arocks_config_t arocks_config_defaults(void);
+/* Set the prefix extractor from "fixed:N", "capped:N" or "delim:C:N" (e.g.
+ * "delim:\::2" makes "tenant:type:" the prefix of "tenant:type:id").
+ * Returns 0, or -1 if spec can't be parsed. */
+int arocks_config_prefix(arocks_config_t *cfg, const char *spec);
+/* Set the key order from "bytes", "natural" or "typed". Returns 0, or -1 if
+ * it's none of those. */
+int arocks_config_key_order(arocks_config_t *cfg, const char *name);
+/* Set the block cache type from "lru" or "hyper-clock". Returns 0, or -1 if
+ * it's neither. */
+int arocks_config_cache_type(arocks_config_t *cfg, const char *name);
+
+/*
+** Keys arocks keeps for itself (index entries and declarations) start with
+** this byte, which never appears in UTF-8 text, so they sort after every
+** user key. Scans stop short of them unless given an end.
+*/
+#define AROCKS_SYS_PREFIX "\xff"
+
+/*
+** Column families: each namespace is a column family with its own
+** memtables, SST files and compactions, so big cold documents can be
+** compacted without stalling reads of small hot ones. A session works in
+** config.column_family (created if it's new) and its tuning applies to
+** that family. RocksDB has to open every family a DB holds, the others get
+** the options they were last opened with (kept in the DB's OPTIONS file),
+** so each namespace keeps its own bloom bits, compression, block size and
+** TTL while another is in use. They share the WAL, the block cache and the
+** background threads. Index declarations and entries live in the family
+** of the documents they index.
+*/
+
+/*
+** A session keeps one rocksdb_t open (along with the options it was opened
+** with and reusable read/write options) so any number of put/get/scan calls
+** can share a single DB open. Open once with arocks_open(), close once with
+** arocks_close().
+**
+** Any number of threads may share a session. A write that keeps indexes up
+** to date reads the stored document first to find the entries to replace,
+** so puts, deletes and indexed merges of one key take turns on one of
+** AROCKS_KEY_STRIPES locks; two at once could otherwise leave stale entries
+** or drop live ones. Index creation and imports aren't covered: run them
+** while nothing else writes.
+*/
+
+#define AROCKS_KEY_STRIPES 64
+typedef struct arocks {
+  rocksdb_t *db;
+  rocksdb_column_family_handle_t *cf; // the session's column family
+  rocksdb_column_family_handle_t **families; // every family, cf among them
+  int nfamilies;
+  rocksdb_options_t *options;
+  rocksdb_readoptions_t *readoptions;
+  rocksdb_writeoptions_t *writeoptions;
+  arocks_config_t config;
+  struct arocks_latency *latency; // per op histograms, with config.statistics
+  char **indexes; // indexed field paths, see arocks_index.h
+  int nindexes;
+  struct arocks_committer *committer; // with config.group_commit
+  struct arocks_txn_db *txn_db;       // with config.transactions
+  struct arocks_snapshot *snapshots;  // open ones, newest first
+  uint64_t snapshot_ids;
+  pthread_mutex_t snapshots_lock;
+  pthread_mutex_t key_locks[AROCKS_KEY_STRIPES]; // for indexed writes
+} arocks_t;
+
+/*
+** A borrowed view of a stored value, pinned in the block cache (or memtable)
+** rather than copied out. data is valid until arocks_release(). len leaves
+** out the trailing '\0' that arocks stores with every value. Binary
+** documents are decoded to JSON text, which the view owns instead.
+*/
+typedef struct arocks_view {
+  const char *data;
+  size_t len;
+  rocksdb_pinnableslice_t *pin;
+  char *text; // decoded binary document, NULL for text values
+} arocks_view_t;
+
+/*
+** Snapshots: the DB as of the moment one is taken. Reads given one see no
+** later write, so a page reading several related keys, or a scan, never
+** sees half of a concurrent update. A snapshot keeps compaction from
+** dropping the versions it can see, so release it once its reads are done;
+** the session tracks the open ones, releases any left at arocks_close and
+** lists those held past AROCKS_SNAPSHOT_LONG_SEC in the stats report.
+** owner is whoever took it (a server connection, say), only its owner can
+** look it up by id or release it with arocks_snapshot_release_owned.
+*/
+#define AROCKS_SNAPSHOT_LONG_SEC 60
+
+typedef struct arocks_snapshot {
+  const rocksdb_snapshot_t *snap;
+  rocksdb_readoptions_t *readoptions; // reads at the snapshot
+  uint64_t id;                        // unique in the session, from 1
+  uint64_t taken_ns;                  // arocks_now_ns()
+  const void *owner;
+  struct arocks_snapshot *next;
+} arocks_snapshot_t;
+
+/*
+** Streaming scans hand each entry to a visitor instead of copying it out, so
+** a scan of any length runs in bounded memory. key and val are borrowed
+** from the iterator and only valid during the call, their lengths leave out
+** the trailing '\0'. Typed keys come as text (see arocks_key_text). Return
+** non-zero from the visitor to stop early.
+*/
+typedef int (*arocks_visit_fn)(const char *key, size_t klen, const char *val,
+                               size_t vlen, void *ctx);
+
+/* What the prefix filters saved during a scan, from the perf context. */
+typedef struct arocks_scan_stats {
+  uint64_t sst_files_checked; // SST prefix filters consulted
+  uint64_t sst_files_skipped; // ... that ruled the file out
+  uint64_t memtable_skipped;  // memtable prefix bloom misses
+  uint64_t blocks_read;       // data blocks read (cache misses)
+  uint64_t blocks_cached;     // data blocks found in the block cache
+} arocks_scan_stats_t;
+
+typedef struct arocks_scan_opts {
+  const char *start; // first key visited (last if reverse), NULL or "" for all
+  const char *end;   // exclusive upper bound, NULL for the last user key
+  long limit;        // max entries visited, 0 for no limit
+  int reverse;       // walk from start (or the end) down
+  int prefix;        // stay within start's prefix (needs a prefix extractor)
+  arocks_scan_stats_t *stats; // filled in when not NULL
+  int raw; // hand binary documents to the visitor undecoded
+  const arocks_snapshot_t *snapshot; // read as of this, NULL for now
+  int keys_only; // never copy values, the visitor gets NULL and 0
+} arocks_scan_opts_t;
+
+typedef struct arocks_cache_stats {
+  size_t capacity;
+  size_t usage;
+  size_t pinned;
+  uint64_t hits;   // these need config.statistics
+  uint64_t misses;
+  uint64_t index_hits;
+  uint64_t filter_hits;
+  uint64_t data_hits;
+} arocks_cache_stats_t;
+
+/*
+** Keys are given as text everywhere, and stored according to the session's
+** key order: bytes and natural keep the text with its '\0', typed keys go
+** through key_codec_put_text so "9" < "10" and ["acme", 7] < ["acme", 12]
+** bytewise, and a range of them is one bounded seek.
+*/
+/* The stored form of key, either key itself or an encoding in b (which is
+ * reset first). Returns its data and its length in len. */
+const char *arocks_key_encode(const arocks_t *s, const char *key,
+                              key_buf_t *b, size_t *len);
+/* A stored key as malloc'd text. */
+char *arocks_key_text(const arocks_t *s, const char *data, size_t len);
+/* Compare stored keys in the session's key order. */
+int arocks_key_compare(const arocks_t *s, const char *a, size_t alen,
+                       const char *b, size_t blen);
+
+arocks_t *arocks_open(const char *db_path);
+arocks_t *arocks_open_with(const char *db_path, const arocks_config_t *cfg);
+void arocks_close(arocks_t *s);
+void arocks_put(arocks_t *s, const char *key, const char *value);
+char *arocks_get(arocks_t *s, const char *key);
+void arocks_delete(arocks_t *s, const char *key);
+/* Queue a JSON merge patch (see arocks_merge.h) against the document at key,
+ * without reading it. Returns 0, or -1 if patch isn't valid JSON. */
+int arocks_merge(arocks_t *s, const char *key, const char *patch);
+/* Atomically add delta to the number at a dotted field path, such as
+ * ":stats.views", in the document at key. Returns 0, or -1 for an empty
+ * path. */
+int arocks_increment(arocks_t *s, const char *key, const char *path,
+                     double delta);
+/* The document at key, decoded straight from its stored form (binary or
+ * text). Returns NULL if key is missing or isn't a document. */
+cJSON *arocks_get_doc(arocks_t *s, const char *key);
+/* Pinned lookup, returns 1 and fills view if key is there, 0 if not. */
+int arocks_get_pinned(arocks_t *s, const char *key, arocks_view_t *view);
+void arocks_release(arocks_view_t *view);
+/* The same reads as of a snapshot, or as of now when snap is NULL. */
+char *arocks_get_at(arocks_t *s, const arocks_snapshot_t *snap,
+                    const char *key);
+int arocks_get_pinned_at(arocks_t *s, const arocks_snapshot_t *snap,
+                         const char *key, arocks_view_t *view);
+/* Look up n keys in one batched MultiGet. vals[i] is set to a malloc'd copy
+ * of the value for keys[i], or NULL if it isn't there. */
+void arocks_multi_get(arocks_t *s, size_t n, const char *const keys[],
+                      char *vals[]);
+/* Same lookup handing back pinned views, release each one with
+ * arocks_release(). A missing key gets a view with NULL data. */
+void arocks_multi_get_pinned(arocks_t *s, size_t n, const char *const keys[],
+                             arocks_view_t views[]);
+void arocks_multi_get_pinned_at(arocks_t *s, const arocks_snapshot_t *snap,
+                                size_t n, const char *const keys[],
+                                arocks_view_t views[]);
+/* Returns the number of entries visited. With fn NULL the scan only counts:
+ * keys and values are left where they are, and the blocks it reads don't
+ * push anything out of the block cache. Keys-only scans and counts still
+ * read the blocks values share with keys, and under BlobDB the iterator
+ * still reads the blob behind each entry it steps onto: the C API can't
+ * defer that. arocks_estimate_count reads neither. */
+long arocks_scan_each(arocks_t *s, const arocks_scan_opts_t *opts,
+                      arocks_visit_fn fn, void *ctx);
+/* Roughly how many keys lie in [start, end), without reading any: the
+ * family's rocksdb.estimate-num-keys, shared out by the SST bytes the range
+ * covers (rocksdb_approximate_sizes). Same bounds as a scan, NULL for all
+ * user keys. bytes, when not NULL, gets the range's SST bytes. Keys written
+ * over or deleted but not yet compacted away are counted, so it runs high
+ * after heavy updates. Nothing flushed yet means nothing to share out, so
+ * then the range is counted (a memtable at most). */
+uint64_t arocks_estimate_count(arocks_t *s, const char *start,
+                               const char *end, uint64_t *bytes);
+arocks_snapshot_t *arocks_snapshot(arocks_t *s, const void *owner);
+void arocks_snapshot_release(arocks_t *s, arocks_snapshot_t *snap);
+/* The open snapshot with id, NULL unless owner took it. */
+arocks_snapshot_t *arocks_snapshot_find(arocks_t *s, uint64_t id,
+                                        const void *owner);
+/* Release every snapshot owner took, returns how many there were. */
+int arocks_snapshot_release_owned(arocks_t *s, const void *owner);
+/* Open snapshots, setting oldest_sec to how long the oldest has been held
+ * (0 with none). */
+int arocks_snapshot_count(arocks_t *s, double *oldest_sec);
+/* List the snapshots held longer than min_sec. */
+void arocks_snapshot_report(arocks_t *s, double min_sec, FILE *out);
+/* Flush and compact the session's column family down to the last level,
+ * rewriting every file (and running blob GC, if it's on). */
+void arocks_compact(arocks_t *s);
+
+/* Value of a RocksDB ticker such as "rocksdb.block.cache.hit", 0 unless the
+ * session was opened with config.statistics. */
+uint64_t arocks_ticker(arocks_t *s, const char *name);
+/* Sum of a RocksDB histogram such as "rocksdb.compaction.times.cpu_micros",
+ * 0 unless the session was opened with config.statistics. */
+uint64_t arocks_histogram_sum(arocks_t *s, const char *name);
+void arocks_cache_stats(arocks_t *s, arocks_cache_stats_t *stats);
+
+/* one-shot helpers, each opens and closes the db */
 void arocks_insert(char *db_path, char *key, char *value);
 char *arocks_select(char *db_path, char *key);
-int arocks_iter(char *db_path, char *key, int count, char *keys[], char *vals[]);
 void alvarez_rocks(void);
 
 #endif // ALVAREZ_ROCKS_H_
@@ -0,0 +1,164 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "arocks.h"
+#include "arocks_backup.h"
+#include "arocks_stats.h"
+#include "rocksdb/c.h"
+
+// a backup directory takes one writer at a time
+static pthread_mutex_t backup_lock = PTHREAD_MUTEX_INITIALIZER;
+
+arocks_backup_opts_t arocks_backup_defaults(void) {
+  arocks_backup_opts_t opts;
+  opts.rate_limit = 0;
+  opts.keep = 0;
+  opts.flush = 1;
+  return opts;
+}
+
+/* Bytes in the regular files under path. */
+static uint64_t dir_bytes(const char *path) {
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    return 0;
+  }
+  uint64_t total = 0;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL) {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+      continue;
+    }
+    size_t len = strlen(path) + strlen(ent->d_name) + 2;
+    char *child = malloc(len);
+    snprintf(child, len, "%s/%s", path, ent->d_name);
+    struct stat st;
+    if (lstat(child, &st) == 0) {
+      if (S_ISDIR(st.st_mode)) {
+        total += dir_bytes(child);
+      } else if (S_ISREG(st.st_mode)) {
+        total += (uint64_t)st.st_size;
+      }
+    }
+    free(child);
+  }
+  closedir(dir);
+  return total;
+}
+
+int arocks_checkpoint(arocks_t *s, const char *dir, char **err) {
+  rocksdb_checkpoint_t *cp = rocksdb_checkpoint_object_create(s->db, err);
+  if (*err != NULL) {
+    return -1;
+  }
+  // 0: always flush first, so writes made without the WAL are in it too
+  rocksdb_checkpoint_create(cp, dir, 0, err);
+  rocksdb_checkpoint_object_destroy(cp);
+  return *err != NULL ? -1 : 0;
+}
+
+static rocksdb_backup_engine_t *engine_open(const char *dir,
+                                            uint64_t rate_limit,
+                                            char **err) {
+  rocksdb_backup_engine_options_t *options =
+      rocksdb_backup_engine_options_create(dir);
+  // SST files are shared between backups, so each one copies only new ones
+  rocksdb_backup_engine_options_set_share_table_files(options, 1);
+  if (rate_limit > 0) {
+    rocksdb_backup_engine_options_set_backup_rate_limit(options, rate_limit);
+  }
+  rocksdb_env_t *env = rocksdb_create_default_env();
+  rocksdb_backup_engine_t *be =
+      rocksdb_backup_engine_open_opts(options, env, err);
+  rocksdb_backup_engine_options_destroy(options);
+  rocksdb_env_destroy(env);
+  return *err != NULL ? NULL : be;
+}
+
+int arocks_backup(arocks_t *s, const char *dir,
+                  const arocks_backup_opts_t *opts,
+                  arocks_backup_report_t *report, char **err) {
+  pthread_mutex_lock(&backup_lock);
+  uint64_t start = arocks_now_ns();
+  uint64_t before = dir_bytes(dir);
+  rocksdb_backup_engine_t *be = engine_open(dir, opts->rate_limit, err);
+  if (be == NULL) {
+    pthread_mutex_unlock(&backup_lock);
+    return -1;
+  }
+  rocksdb_backup_engine_create_new_backup_flush(be, s->db,
+                                                (unsigned char)opts->flush,
+                                                err);
+  // measured before purging, which can free more than the backup took
+  uint64_t after = *err == NULL ? dir_bytes(dir) : before;
+  if (*err == NULL && opts->keep > 0) {
+    rocksdb_backup_engine_purge_old_backups(be, (uint32_t)opts->keep, err);
+  }
+  if (*err == NULL && report != NULL) {
+    const rocksdb_backup_engine_info_t *info =
+        rocksdb_backup_engine_get_backup_info(be);
+    int n = rocksdb_backup_engine_info_count(info);
+    // newest last
+    report->id = rocksdb_backup_engine_info_backup_id(info, n - 1);
+    report->files = rocksdb_backup_engine_info_number_files(info, n - 1);
+    report->size = rocksdb_backup_engine_info_size(info, n - 1);
+    report->backups = n;
+    report->copied = after > before ? after - before : 0;
+    report->seconds = (arocks_now_ns() - start) / 1e9;
+    rocksdb_backup_engine_info_destroy(info);
+  }
+  rocksdb_backup_engine_close(be);
+  pthread_mutex_unlock(&backup_lock);
+  return *err != NULL ? -1 : 0;
+}
+
+int arocks_backup_list(const char *dir, FILE *out, char **err) {
+  rocksdb_backup_engine_t *be = engine_open(dir, 0, err);
+  if (be == NULL) {
+    return -1;
+  }
+  const rocksdb_backup_engine_info_t *info =
+      rocksdb_backup_engine_get_backup_info(be);
+  int n = rocksdb_backup_engine_info_count(info);
+  fprintf(out, "%6s  %-19s %8s %14s\n", "backup", "taken", "files", "bytes");
+  for (int i = 0; i < n; i++) {
+    time_t taken = (time_t)rocksdb_backup_engine_info_timestamp(info, i);
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&taken));
+    fprintf(out, "%6u  %-19s %8u %14llu\n",
+            rocksdb_backup_engine_info_backup_id(info, i), when,
+            rocksdb_backup_engine_info_number_files(info, i),
+            (unsigned long long)rocksdb_backup_engine_info_size(info, i));
+  }
+  fprintf(out, "%llu bytes in %s\n", (unsigned long long)dir_bytes(dir), dir);
+  rocksdb_backup_engine_info_destroy(info);
+  rocksdb_backup_engine_close(be);
+  return 0;
+}
+
+int arocks_backup_restore(const char *dir, const char *db_path, char **err) {
+  rocksdb_backup_engine_t *be = engine_open(dir, 0, err);
+  if (be == NULL) {
+    return -1;
+  }
+  rocksdb_restore_options_t *options = rocksdb_restore_options_create();
+  rocksdb_backup_engine_restore_db_from_latest_backup(be, db_path, db_path,
+                                                      options, err);
+  rocksdb_restore_options_destroy(options);
+  rocksdb_backup_engine_close(be);
+  return *err != NULL ? -1 : 0;
+}
+
+void arocks_backup_print(const arocks_backup_report_t *r, FILE *out) {
+  fprintf(out,
+          "backup %u: %u files, %llu bytes, %llu copied in %.2fs "
+          "(%d backups kept)\n",
+          r->id, r->files, (unsigned long long)r->size,
+          (unsigned long long)r->copied, r->seconds, r->backups);
+}
@@ -0,0 +1,70 @@
+#ifndef ALVAREZ_ROCKS_BACKUP_H_
+#define ALVAREZ_ROCKS_BACKUP_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arocks.h"
+
+/*
+** Copies of a live DB. Copying the directory while modric runs can catch
+** files half written or miss ones compaction swaps in, and it reads every
+** byte again. Instead:
+**
+**   - a checkpoint is a consistent copy of every column family in a new
+**     directory, made in milliseconds: SST files are immutable, so they're
+**     hard-linked (copied only across filesystems) and only the small
+**     MANIFEST, OPTIONS and WAL files are written. It takes no space until
+**     compaction retires the linked files, and opens as a DB of its own.
+**   - a backup directory holds numbered backups sharing their SST files.
+**     Each backup copies only the files no earlier backup has, checksums
+**     them, and can be rate limited so a nightly run doesn't starve the DB
+**     of disk bandwidth. Old backups are purged down to a count, files
+**     still shared with newer ones stay.
+**
+** Both run against an open session, server connections included, while
+** reads and writes go on.
+*/
+
+typedef struct arocks_backup_opts {
+  uint64_t rate_limit; // bytes per second copied, 0 for no limit
+  int keep;            // backups kept after this one, 0 for all
+  int flush; // flush memtables first, so the backup needs no WAL replay
+} arocks_backup_opts_t;
+
+arocks_backup_opts_t arocks_backup_defaults(void);
+
+typedef struct arocks_backup_report {
+  uint32_t id;
+  uint32_t files;
+  uint64_t size;   // bytes in the backup, shared files included
+  uint64_t copied; // bytes copied to make it
+  int backups;     // in the directory afterwards
+  double seconds;
+} arocks_backup_report_t;
+
+/*
+** Errors come back in err (malloc'd, and NULL going in as with RocksDB's
+** errptr) with -1, rather than aborting like the rest of arocks: they're
+** about the directory given, not the DB.
+*/
+
+/* Checkpoint the DB into dir, which must not exist yet. */
+int arocks_checkpoint(arocks_t *s, const char *dir, char **err);
+
+/* Back the DB up into dir (created if it's new), reporting on the backup
+ * when report isn't NULL. Backups from one process take turns. */
+int arocks_backup(arocks_t *s, const char *dir,
+                  const arocks_backup_opts_t *opts,
+                  arocks_backup_report_t *report, char **err);
+
+/* Print the backups in dir, oldest first. */
+int arocks_backup_list(const char *dir, FILE *out, char **err);
+
+/* Restore the latest backup in dir into db_path, which mustn't be open;
+ * its files are replaced. */
+int arocks_backup_restore(const char *dir, const char *db_path, char **err);
+
+void arocks_backup_print(const arocks_backup_report_t *report, FILE *out);
+
+#endif // ALVAREZ_ROCKS_BACKUP_H_
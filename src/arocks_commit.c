@@ -0,0 +1,220 @@
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arocks.h"
+#include "arocks_commit.h"
+#include "rocksdb/c.h"
+
+struct arocks_committer {
+  arocks_t *s;
+  // Vyukov's intrusive MPSC queue: producers swap themselves in at head,
+  // the committer alone pops from tail, stub stands in when it's empty
+  arocks_commit_req_t *head;
+  arocks_commit_req_t *tail;
+  arocks_commit_req_t stub;
+  sem_t pending; // posted once per request pushed, after it's linked
+  rocksdb_writeoptions_t *unsynced;
+  rocksdb_writeoptions_t *synced; // for the last batch of a group
+  size_t max_bytes;
+  uint64_t max_delay_us;
+  pthread_t thread;
+  arocks_commit_stats_t stats;
+};
+
+/*
+** Queue
+*/
+
+static void push(arocks_committer_t *c, arocks_commit_req_t *req) {
+  __atomic_store_n(&req->next, NULL, __ATOMIC_RELAXED);
+  arocks_commit_req_t *prev =
+      __atomic_exchange_n(&c->head, req, __ATOMIC_ACQ_REL);
+  // until this lands the committer can't reach req, or anything after it
+  __atomic_store_n(&prev->next, req, __ATOMIC_RELEASE);
+}
+
+/* The oldest request, or NULL if there's none or the next one hasn't been
+ * linked in yet. */
+static arocks_commit_req_t *pop(arocks_committer_t *c) {
+  arocks_commit_req_t *tail = c->tail;
+  arocks_commit_req_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  if (tail == &c->stub) {
+    if (next == NULL) {
+      return NULL;
+    }
+    c->tail = next;
+    tail = next;
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  }
+  if (next != NULL) {
+    c->tail = next;
+    return tail;
+  }
+  if (tail != __atomic_load_n(&c->head, __ATOMIC_ACQUIRE)) {
+    return NULL; // a push is between its exchange and its link
+  }
+  // tail is the only one left, queue the stub behind it so it can go
+  push(c, &c->stub);
+  next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  if (next != NULL) {
+    c->tail = next;
+    return tail;
+  }
+  return NULL;
+}
+
+/* A request the semaphore says is queued, waiting out a push that hasn't
+ * linked it yet (it's two instructions away). */
+static arocks_commit_req_t *take(arocks_committer_t *c) {
+  arocks_commit_req_t *req;
+  while ((req = pop(c)) == NULL) {
+    sched_yield();
+  }
+  return req;
+}
+
+/*
+** Committer
+*/
+
+static size_t batch_bytes(rocksdb_writebatch_t *batch) {
+  size_t size = 0;
+  rocksdb_writebatch_data(batch, &size);
+  return size;
+}
+
+/* Write the group's batches, syncing with the last one, then let their
+ * callers go. A failed sync fails every batch it was meant to cover. */
+static void commit(arocks_committer_t *c, arocks_commit_req_t *group,
+                   size_t bytes) {
+  uint64_t n = 0;
+  arocks_commit_req_t *last = NULL;
+  for (arocks_commit_req_t *req = group; req != NULL; req = req->group) {
+    const rocksdb_writeoptions_t *wo =
+        req->group == NULL ? c->synced : c->unsynced;
+    rocksdb_write(c->s->db, wo, req->batch, &req->err);
+    last = req;
+    n++;
+  }
+  for (arocks_commit_req_t *req = group; req != NULL;) {
+    if (req->err == NULL && last->err != NULL) {
+      req->err = strdup(last->err);
+    }
+    // the caller may free req as soon as it's posted
+    arocks_commit_req_t *next = req->group;
+    sem_post(&req->done);
+    req = next;
+  }
+  __atomic_add_fetch(&c->stats.writes, n, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&c->stats.groups, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&c->stats.bytes, bytes, __ATOMIC_RELAXED);
+}
+
+static void deadline_in(struct timespec *ts, uint64_t us) {
+  clock_gettime(CLOCK_REALTIME, ts); // sem_timedwait's clock
+  uint64_t ns = (uint64_t)ts->tv_nsec + us * 1000;
+  ts->tv_sec += ns / 1000000000;
+  ts->tv_nsec = ns % 1000000000;
+}
+
+/* A request with no batch asks the committer to stop, once everything
+ * ahead of it is committed. */
+static void *committer(void *arg) {
+  arocks_committer_t *c = arg;
+  int stopping = 0;
+  while (!stopping) {
+    while (sem_wait(&c->pending) != 0) {
+    }
+    arocks_commit_req_t *group = take(c);
+    if (group->batch == NULL) {
+      break;
+    }
+    group->group = NULL;
+    arocks_commit_req_t *last = group;
+    size_t bytes = batch_bytes(group->batch);
+    struct timespec deadline;
+    deadline_in(&deadline, c->max_delay_us);
+    while (bytes < c->max_bytes) {
+      if (sem_trywait(&c->pending) != 0 &&
+          (c->max_delay_us == 0 ||
+           sem_timedwait(&c->pending, &deadline) != 0)) {
+        break;
+      }
+      arocks_commit_req_t *req = take(c);
+      if (req->batch == NULL) {
+        stopping = 1;
+        break;
+      }
+      req->group = NULL;
+      last->group = req;
+      last = req;
+      bytes += batch_bytes(req->batch);
+    }
+    commit(c, group, bytes);
+  }
+  return NULL;
+}
+
+arocks_committer_t *arocks_commit_start(arocks_t *s) {
+  arocks_committer_t *c = calloc(1, sizeof(arocks_committer_t));
+  c->s = s;
+  c->head = &c->stub;
+  c->tail = &c->stub;
+  sem_init(&c->pending, 0, 0);
+  c->unsynced = rocksdb_writeoptions_create();
+  c->synced = rocksdb_writeoptions_create();
+  rocksdb_writeoptions_set_sync(c->synced, s->config.sync_writes);
+  c->max_bytes = s->config.group_commit_bytes;
+  c->max_delay_us = s->config.group_commit_delay_us;
+  pthread_create(&c->thread, NULL, committer, c);
+  return c;
+}
+
+void arocks_commit_stop(arocks_committer_t *c) {
+  arocks_commit_req_t stop;
+  arocks_commit_submit(c, &stop, NULL);
+  pthread_join(c->thread, NULL);
+  sem_destroy(&stop.done);
+  sem_destroy(&c->pending);
+  rocksdb_writeoptions_destroy(c->unsynced);
+  rocksdb_writeoptions_destroy(c->synced);
+  free(c);
+}
+
+/*
+** Callers
+*/
+
+void arocks_commit_submit(arocks_committer_t *c, arocks_commit_req_t *req,
+                          rocksdb_writebatch_t *batch) {
+  req->batch = batch;
+  req->err = NULL;
+  req->group = NULL;
+  sem_init(&req->done, 0, 0);
+  push(c, req);
+  sem_post(&c->pending);
+}
+
+char *arocks_commit_wait(arocks_commit_req_t *req) {
+  while (sem_wait(&req->done) != 0) {
+  }
+  sem_destroy(&req->done);
+  return req->err;
+}
+
+void arocks_commit_write(arocks_committer_t *c, rocksdb_writebatch_t *batch) {
+  arocks_commit_req_t req;
+  arocks_commit_submit(c, &req, batch);
+  char *err = arocks_commit_wait(&req);
+  ERR(err);
+}
+
+void arocks_commit_stats(arocks_committer_t *c, arocks_commit_stats_t *stats) {
+  stats->writes = __atomic_load_n(&c->stats.writes, __ATOMIC_RELAXED);
+  stats->groups = __atomic_load_n(&c->stats.groups, __ATOMIC_RELAXED);
+  stats->bytes = __atomic_load_n(&c->stats.bytes, __ATOMIC_RELAXED);
+}
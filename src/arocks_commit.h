@@ -0,0 +1,59 @@
+#ifndef ALVAREZ_ROCKS_COMMIT_H_
+#define ALVAREZ_ROCKS_COMMIT_H_
+
+#include <semaphore.h>
+#include <stdint.h>
+
+#include "arocks.h"
+
+/*
+** Group commit. With config.sync_writes every write waits for the WAL to be
+** synced, so a session shared by many threads (mserve) tops out at the
+** device's fsync rate. With config.group_commit as well, the session's puts,
+** deletes and merges go to a committer thread instead:
+**
+**   - callers push a request holding their batch onto a lock-free queue
+**     (one atomic exchange, no lock) and wait on it
+**   - the committer takes everything queued, up to group_commit_bytes,
+**     waiting up to group_commit_delay_us after the first request for more
+**   - it writes the group's batches, syncing the WAL once with the last of
+**     them, then completes every request in the group
+**
+** While one group syncs the next one queues up, so durable writes per second
+** grow with the number of writers. Each caller's batch still commits
+** atomically, and nobody hears back before the sync covering their batch.
+*/
+
+typedef struct arocks_commit_req {
+  rocksdb_writebatch_t *batch;
+  char *err; // why the write failed, NULL if it didn't
+  sem_t done;
+  struct arocks_commit_req *next;  // in the queue
+  struct arocks_commit_req *group; // in the committer's current group
+} arocks_commit_req_t;
+
+typedef struct arocks_committer arocks_committer_t;
+
+/* Start committing the session's writes with the limits in s->config. */
+arocks_committer_t *arocks_commit_start(arocks_t *s);
+/* Commit whatever is queued, then stop the committer and free it. */
+void arocks_commit_stop(arocks_committer_t *c);
+
+/* Queue batch, which the caller keeps until arocks_commit_wait returns. */
+void arocks_commit_submit(arocks_committer_t *c, arocks_commit_req_t *req,
+                          rocksdb_writebatch_t *batch);
+/* Wait for a submitted request. Returns NULL once its batch is durable, or
+ * the error to free otherwise. */
+char *arocks_commit_wait(arocks_commit_req_t *req);
+/* Submit and wait, aborting on an error like the rest of arocks. */
+void arocks_commit_write(arocks_committer_t *c, rocksdb_writebatch_t *batch);
+
+typedef struct arocks_commit_stats {
+  uint64_t writes; // batches committed
+  uint64_t groups; // ... and the syncs they took
+  uint64_t bytes;
+} arocks_commit_stats_t;
+
+void arocks_commit_stats(arocks_committer_t *c, arocks_commit_stats_t *stats);
+
+#endif // ALVAREZ_ROCKS_COMMIT_H_
@@ -0,0 +1,269 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zdict.h>
+#include <zstd.h>
+
+#include "arocks.h"
+#include "arocks_dict.h"
+#include "arocks_stats.h"
+#include "rocksdb/c.h"
+
+// values looked at before the stride through the rest is picked
+#define STRIDE_PROBE 64
+// decompress the measured half for at least this long
+#define TIMING_NS 200000000ull
+
+arocks_dict_opts_t arocks_dict_defaults(const arocks_config_t *cfg) {
+  arocks_dict_opts_t opts;
+  opts.dict_bytes = cfg->zstd_dict_bytes > 0 ? (size_t)cfg->zstd_dict_bytes
+                                             : AROCKS_DICT_DEFAULT_BYTES;
+  opts.sample_bytes = cfg->zstd_train_bytes > 0
+                          ? (size_t)cfg->zstd_train_bytes
+                          : opts.dict_bytes * 100;
+  opts.level = 3;
+  opts.compact = cfg->zstd_dict_bytes > 0;
+  return opts;
+}
+
+/*
+** Sampling
+*/
+
+typedef struct sample_state {
+  char *data;     // samples back to back, as ZDICT wants them
+  size_t *sizes;
+  long n;
+  long cap;
+  size_t len;
+  size_t data_cap;
+  size_t budget;
+  uint64_t keys; // estimated, for the stride
+  long seen;
+  long stride;
+} sample_state;
+
+static void add_sample(sample_state *st, const char *val, size_t vlen) {
+  if (st->n == st->cap) {
+    st->cap = st->cap == 0 ? 1024 : st->cap * 2;
+    st->sizes = realloc(st->sizes, st->cap * sizeof(size_t));
+  }
+  if (st->len + vlen > st->data_cap) {
+    st->data_cap = (st->len + vlen) * 2;
+    st->data = realloc(st->data, st->data_cap);
+  }
+  memcpy(st->data + st->len, val, vlen);
+  st->sizes[st->n++] = vlen;
+  st->len += vlen;
+}
+
+/* Take the first STRIDE_PROBE values, then every stride-th one, with the
+ * stride set from their average size so the budget lasts the whole DB. */
+static int sample_value(const char *key, size_t klen, const char *val,
+                        size_t vlen, void *ctx) {
+  (void)key;
+  (void)klen;
+  sample_state *st = ctx;
+  if (vlen == 0 || st->seen++ % st->stride != 0) {
+    return 0;
+  }
+  add_sample(st, val, vlen);
+  if (st->n == STRIDE_PROBE) {
+    double wanted = (double)st->budget / ((double)st->len / st->n);
+    double stride = (double)st->keys / (wanted > 1 ? wanted : 1);
+    st->stride = stride > 1 ? (long)stride : 1;
+    st->seen = 0;
+  }
+  return st->len >= st->budget;
+}
+
+/*
+** Measuring
+*/
+
+typedef struct measured {
+  size_t compressed;
+  double mb_per_sec;
+} measured;
+
+/* Compress the samples picked by step/first one by one, with cdict if it's
+ * given, then time decompressing them all. */
+static measured measure(const sample_state *st, long first, long step,
+                        int level, ZSTD_CDict *cdict, ZSTD_DDict *ddict) {
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+  ZSTD_DCtx *dctx = ZSTD_createDCtx();
+  long n = (st->n - first + step - 1) / step;
+  char **frames = malloc(n * sizeof(char *));
+  size_t *frame_sizes = malloc(n * sizeof(size_t));
+  const char **values = malloc(n * sizeof(char *));
+  size_t *value_sizes = malloc(n * sizeof(size_t));
+  measured m = {0, 0};
+  size_t max_value = 0;
+
+  const char *p = st->data;
+  long j = 0;
+  for (long i = 0; i < st->n; i++) {
+    size_t len = st->sizes[i];
+    if (i >= first && (i - first) % step == 0) {
+      size_t bound = ZSTD_compressBound(len);
+      char *frame = malloc(bound);
+      size_t c = cdict != NULL
+                     ? ZSTD_compress_usingCDict(cctx, frame, bound, p, len,
+                                                cdict)
+                     : ZSTD_compressCCtx(cctx, frame, bound, p, len, level);
+      frames[j] = frame;
+      frame_sizes[j] = ZSTD_isError(c) ? 0 : c;
+      values[j] = p;
+      value_sizes[j] = len;
+      m.compressed += frame_sizes[j];
+      max_value = len > max_value ? len : max_value;
+      j++;
+    }
+    p += len;
+  }
+
+  char *out = malloc(max_value > 0 ? max_value : 1);
+  uint64_t start = arocks_now_ns();
+  uint64_t elapsed = 0;
+  size_t decompressed = 0;
+  while (elapsed < TIMING_NS) {
+    for (long i = 0; i < n; i++) {
+      size_t d =
+          ddict != NULL
+              ? ZSTD_decompress_usingDDict(dctx, out, value_sizes[i],
+                                           frames[i], frame_sizes[i], ddict)
+              : ZSTD_decompressDCtx(dctx, out, value_sizes[i], frames[i],
+                                    frame_sizes[i]);
+      if (ZSTD_isError(d) || memcmp(out, values[i], d) != 0) {
+        fprintf(stderr, "zstd round trip failed for sample %ld\n", i);
+        exit(1);
+      }
+      decompressed += d;
+    }
+    elapsed = arocks_now_ns() - start;
+  }
+  m.mb_per_sec = decompressed / (elapsed / 1e9) / (1 << 20);
+
+  for (long i = 0; i < n; i++) {
+    free(frames[i]);
+  }
+  free(out);
+  free(frames);
+  free(frame_sizes);
+  free(values);
+  free(value_sizes);
+  ZSTD_freeCCtx(cctx);
+  ZSTD_freeDCtx(dctx);
+  return m;
+}
+
+static uint64_t sst_size(arocks_t *s) {
+  uint64_t size = 0;
+  rocksdb_property_int_cf(s->db, s->cf, "rocksdb.total-sst-files-size",
+                          &size);
+  return size;
+}
+
+static void compact(arocks_t *s, arocks_dict_report_t *report) {
+  char *err = NULL;
+  // memtable contents count as "before" too
+  rocksdb_flushoptions_t *flushoptions = rocksdb_flushoptions_create();
+  rocksdb_flushoptions_set_wait(flushoptions, 1);
+  rocksdb_flush_cf(s->db, flushoptions, s->cf, &err);
+  ERR(err);
+  rocksdb_flushoptions_destroy(flushoptions);
+  report->sst_before = sst_size(s);
+  // forced through the last level, or files already there (ingested, or
+  // compacted before) would never be rewritten with the dictionary
+  arocks_compact(s);
+  report->sst_after = sst_size(s);
+}
+
+int arocks_dict_train(arocks_t *s, const arocks_dict_opts_t *opts,
+                      arocks_dict_report_t *report) {
+  memset(report, 0, sizeof(*report));
+  sample_state st;
+  memset(&st, 0, sizeof(st));
+  st.budget = opts->sample_bytes;
+  st.stride = 1;
+  rocksdb_property_int_cf(s->db, s->cf, "rocksdb.estimate-num-keys",
+                          &st.keys);
+  // raw: RocksDB compresses the stored form, binary documents included
+  arocks_scan_opts_t scan = {NULL, NULL, 0, 0, 0, NULL, 1};
+  arocks_scan_each(s, &scan, sample_value, &st);
+  report->samples = st.n;
+  report->sample_bytes = st.len;
+
+  int rc = -1;
+  // train on the even samples, measure on the odd ones
+  long ntrain = (st.n + 1) / 2;
+  if (st.n >= 16) {
+    size_t *train_sizes = malloc(ntrain * sizeof(size_t));
+    char *train = malloc(st.len);
+    size_t train_len = 0;
+    const char *p = st.data;
+    for (long i = 0; i < st.n; i++) {
+      if (i % 2 == 0) {
+        memcpy(train + train_len, p, st.sizes[i]);
+        train_sizes[i / 2] = st.sizes[i];
+        train_len += st.sizes[i];
+      }
+      p += st.sizes[i];
+    }
+    char *dict = malloc(opts->dict_bytes);
+    size_t dict_len = ZDICT_trainFromBuffer(dict, opts->dict_bytes, train,
+                                            train_sizes, (unsigned)ntrain);
+    if (!ZDICT_isError(dict_len)) {
+      report->dict_bytes = dict_len;
+      ZSTD_CDict *cdict = ZSTD_createCDict(dict, dict_len, opts->level);
+      ZSTD_DDict *ddict = ZSTD_createDDict(dict, dict_len);
+      measured plain = measure(&st, 1, 2, opts->level, NULL, NULL);
+      measured with = measure(&st, 1, 2, opts->level, cdict, ddict);
+      report->test_bytes = st.len - train_len;
+      report->plain_bytes = plain.compressed;
+      report->plain_mb_per_sec = plain.mb_per_sec;
+      report->dict_compressed_bytes = with.compressed;
+      report->dict_mb_per_sec = with.mb_per_sec;
+      ZSTD_freeCDict(cdict);
+      ZSTD_freeDDict(ddict);
+      rc = 0;
+    } else {
+      fprintf(stderr, "Dictionary training failed: %s\n",
+              ZDICT_getErrorName(dict_len));
+    }
+    free(dict);
+    free(train);
+    free(train_sizes);
+  }
+  free(st.data);
+  free(st.sizes);
+
+  if (rc == 0 && opts->compact) {
+    compact(s, report);
+  }
+  return rc;
+}
+
+static double ratio(size_t raw, size_t compressed) {
+  return compressed > 0 ? (double)raw / compressed : 0;
+}
+
+void arocks_dict_print(const arocks_dict_report_t *r, FILE *out) {
+  fprintf(out, "sampled %ld values (%zu bytes), trained a %zu byte dictionary "
+               "on half\n",
+          r->samples, r->sample_bytes, r->dict_bytes);
+  fprintf(out, "%-18s %10s %10s %14s\n", "per value", "bytes", "ratio",
+          "decompress");
+  fprintf(out, "%-18s %10zu\n", "uncompressed", r->test_bytes);
+  fprintf(out, "%-18s %10zu %9.2fx %9.1f MB/s\n", "zstd", r->plain_bytes,
+          ratio(r->test_bytes, r->plain_bytes), r->plain_mb_per_sec);
+  fprintf(out, "%-18s %10zu %9.2fx %9.1f MB/s\n", "zstd + dictionary",
+          r->dict_compressed_bytes,
+          ratio(r->test_bytes, r->dict_compressed_bytes), r->dict_mb_per_sec);
+  if (r->sst_before > 0) {
+    fprintf(out, "sst files %llu -> %llu bytes after compaction\n",
+            (unsigned long long)r->sst_before,
+            (unsigned long long)r->sst_after);
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef ALVAREZ_ROCKS_DICT_H_
+#define ALVAREZ_ROCKS_DICT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arocks.h"
+
+/*
+** Zstd dictionary compression. Small documents compress poorly a block at
+** a time, every block starts with no history, while a dictionary trained
+** on sample values primes zstd with the field names and strings they all
+** share. RocksDB trains a dictionary per SST file once config.zstd_dict_bytes
+** is set; arocks_dict_train samples the values already stored to show what
+** that buys, then compacts so every existing file gets one:
+**
+**   - sample values across the key space, up to sample_bytes of them
+**   - train a dict_bytes dictionary on half of the samples (ZDICT)
+**   - compress the other half one value at a time, without and with the
+**     dictionary, and time decompressing both
+**   - flush and compact the whole DB, noting the SST size either side
+*/
+
+#define AROCKS_DICT_DEFAULT_BYTES (16 << 10)
+
+typedef struct arocks_dict_opts {
+  size_t dict_bytes;   // dictionary to train
+  size_t sample_bytes; // budget for sampled values
+  int level;           // zstd level for the measurements
+  int compact;         // rewrite the SST files afterwards
+} arocks_dict_opts_t;
+
+/* Defaults matching the session's config, compacting only if it has a
+ * dictionary configured (otherwise the rewrite wouldn't use one). */
+arocks_dict_opts_t arocks_dict_defaults(const arocks_config_t *cfg);
+
+typedef struct arocks_dict_report {
+  long samples;                 // values sampled
+  size_t sample_bytes;
+  size_t dict_bytes;            // size actually trained
+  size_t test_bytes;            // measured half, uncompressed
+  size_t plain_bytes;           // ... compressed without the dictionary
+  size_t dict_compressed_bytes; // ... and with it
+  double plain_mb_per_sec;      // decompression, uncompressed MB/s
+  double dict_mb_per_sec;
+  uint64_t sst_before; // total SST file size, when compacting
+  uint64_t sst_after;
+} arocks_dict_report_t;
+
+/* Returns 0, or -1 if there weren't enough values to train on. */
+int arocks_dict_train(arocks_t *s, const arocks_dict_opts_t *opts,
+                      arocks_dict_report_t *report);
+
+void arocks_dict_print(const arocks_dict_report_t *report, FILE *out);
+
+#endif // ALVAREZ_ROCKS_DICT_H_
@@ -0,0 +1,540 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arocks_doc.h"
+#include "cJSON.h"
+#include "edn_parse.h"
+#include "json_path.h"
+#include "key_codec.h"
+
+#define TAG_NULL 0x00
+#define TAG_FALSE 0x01
+#define TAG_TRUE 0x02
+#define TAG_INT 0x03
+#define TAG_DOUBLE 0x04
+#define TAG_STRING 0x05
+#define TAG_ARRAY 0x06
+#define TAG_OBJECT 0x07 // offsets of 1 byte, then 2 and 4
+#define TAG_OBJECT16 0x08
+#define TAG_OBJECT32 0x09
+
+// integral doubles within this are exact, so they're stored as ints
+#define MAX_EXACT_INT 9007199254740992.0
+
+static const char *skip_space(const char *text) {
+  while (*text != '\0' && (unsigned char)*text <= 32) {
+    text++;
+  }
+  return text;
+}
+
+cJSON *arocks_doc_parse(const char *text) {
+  const char *p = skip_space(text);
+  if (*p == '{' && *skip_space(p + 1) == ':') {
+    return edn_parse(p);
+  }
+  return cJSON_Parse(p);
+}
+
+int arocks_doc_is_binary(const char *data, size_t len) {
+  return len >= AROCKS_DOC_MAGIC_LEN &&
+         memcmp(data, AROCKS_DOC_MAGIC, AROCKS_DOC_MAGIC_LEN) == 0;
+}
+
+/*
+** Encoding
+*/
+
+static void put_byte(key_buf_t *b, unsigned char c) {
+  key_buf_append(b, &c, 1);
+}
+
+static void put_varint(key_buf_t *b, uint64_t v) {
+  unsigned char out[10];
+  int n = 0;
+  while (v >= 0x80) {
+    out[n++] = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (unsigned char)v;
+  key_buf_append(b, out, n);
+}
+
+/* A little-endian offset, width bytes of it. */
+static void put_offset(key_buf_t *b, uint32_t v, int width) {
+  unsigned char out[4] = {(unsigned char)v, (unsigned char)(v >> 8),
+                          (unsigned char)(v >> 16), (unsigned char)(v >> 24)};
+  key_buf_append(b, out, width);
+}
+
+static void put_double(key_buf_t *b, double d) {
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  unsigned char out[8];
+  for (int i = 0; i < 8; i++) {
+    out[i] = (unsigned char)(bits >> (8 * i));
+  }
+  key_buf_append(b, out, 8);
+}
+
+typedef struct field_ref {
+  const char *key;
+  uint32_t offset;
+} field_ref;
+
+static int field_ref_cmp(const void *a, const void *b) {
+  return strcmp(((const field_ref *)a)->key, ((const field_ref *)b)->key);
+}
+
+static void encode_value(key_buf_t *b, const cJSON *item);
+
+/* varint count, varint size, then body; the size isn't known up front so
+ * the body is built on the side */
+static void put_container(key_buf_t *b, unsigned char tag, size_t count,
+                          const key_buf_t *body) {
+  put_byte(b, tag);
+  put_varint(b, count);
+  put_varint(b, body->len);
+  key_buf_append(b, body->data, body->len);
+}
+
+static void encode_array(key_buf_t *b, const cJSON *array) {
+  key_buf_t body;
+  key_buf_init(&body);
+  size_t count = 0;
+  const cJSON *item;
+  cJSON_ArrayForEach(item, array) {
+    encode_value(&body, item);
+    count++;
+  }
+  put_container(b, TAG_ARRAY, count, &body);
+  key_buf_free(&body);
+}
+
+static void encode_object(key_buf_t *b, const cJSON *object) {
+  size_t count = (size_t)cJSON_GetArraySize(object);
+  field_ref *refs = malloc((count > 0 ? count : 1) * sizeof(field_ref));
+  key_buf_t fields;
+  key_buf_init(&fields);
+  size_t i = 0;
+  const cJSON *item;
+  cJSON_ArrayForEach(item, object) {
+    refs[i].key = item->string != NULL ? item->string : "";
+    refs[i].offset = (uint32_t)fields.len;
+    size_t klen = strlen(refs[i].key);
+    put_varint(&fields, klen);
+    key_buf_append(&fields, refs[i].key, klen);
+    encode_value(&fields, item);
+    i++;
+  }
+  // the narrowest offsets that reach the last field
+  uint32_t last = count > 0 ? refs[count - 1].offset : 0;
+  qsort(refs, count, sizeof(field_ref), field_ref_cmp);
+
+  int width = last <= 0xff ? 1 : last <= 0xffff ? 2 : 4;
+  key_buf_t body;
+  key_buf_init(&body);
+  for (i = 0; i < count; i++) {
+    put_offset(&body, refs[i].offset, width);
+  }
+  if (fields.len > 0) {
+    key_buf_append(&body, fields.data, fields.len);
+  }
+  put_container(b, width == 1 ? TAG_OBJECT : width == 2 ? TAG_OBJECT16
+                                                        : TAG_OBJECT32,
+                count, &body);
+  key_buf_free(&body);
+  key_buf_free(&fields);
+  free(refs);
+}
+
+static void encode_value(key_buf_t *b, const cJSON *item) {
+  if (cJSON_IsFalse(item)) {
+    put_byte(b, TAG_FALSE);
+  } else if (cJSON_IsTrue(item)) {
+    put_byte(b, TAG_TRUE);
+  } else if (cJSON_IsNumber(item)) {
+    double d = item->valuedouble;
+    if (d >= -MAX_EXACT_INT && d <= MAX_EXACT_INT && d == (double)(int64_t)d) {
+      int64_t v = (int64_t)d;
+      put_byte(b, TAG_INT);
+      put_varint(b, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+    } else {
+      put_byte(b, TAG_DOUBLE);
+      put_double(b, d);
+    }
+  } else if (cJSON_IsString(item)) {
+    size_t len = strlen(item->valuestring);
+    put_byte(b, TAG_STRING);
+    put_varint(b, len);
+    key_buf_append(b, item->valuestring, len);
+  } else if (cJSON_IsArray(item)) {
+    encode_array(b, item);
+  } else if (cJSON_IsObject(item)) {
+    encode_object(b, item);
+  } else {
+    // null, and anything cJSON can't print as JSON
+    put_byte(b, TAG_NULL);
+  }
+}
+
+char *arocks_doc_encode(const cJSON *doc, size_t *len) {
+  key_buf_t b;
+  key_buf_init(&b);
+  key_buf_append(&b, AROCKS_DOC_MAGIC, AROCKS_DOC_MAGIC_LEN);
+  encode_value(&b, doc);
+  *len = b.len;
+  return b.data;
+}
+
+char *arocks_doc_store(const cJSON *doc, int binary, size_t *len) {
+  if (binary && (cJSON_IsObject(doc) || cJSON_IsArray(doc))) {
+    return arocks_doc_encode(doc, len);
+  }
+  char *text = cJSON_PrintUnformatted(doc);
+  *len = strlen(text) + 1;
+  return text;
+}
+
+/*
+** Decoding. Every read is bounds checked against the end of the value, a
+** truncated or corrupt document decodes to NULL rather than reading past it.
+*/
+
+typedef struct reader {
+  const unsigned char *p;
+  const unsigned char *end;
+} reader;
+
+static int get_varint(reader *r, uint64_t *v) {
+  *v = 0;
+  for (int shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+    unsigned char c = *r->p++;
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    if (c < 0x80) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int get_size(reader *r, size_t *len) {
+  uint64_t v;
+  if (!get_varint(r, &v) || v > (uint64_t)(r->end - r->p)) {
+    return 0;
+  }
+  *len = (size_t)v;
+  return 1;
+}
+
+static uint32_t get_offset(const unsigned char *p, int width) {
+  switch (width) {
+  case 1:
+    return p[0];
+  case 2:
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8;
+  }
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static int offset_width(unsigned char tag) {
+  return tag == TAG_OBJECT ? 1 : tag == TAG_OBJECT16 ? 2 : 4;
+}
+
+/* Move past one value without decoding it. */
+static int skip_value(reader *r) {
+  if (r->p >= r->end) {
+    return 0;
+  }
+  unsigned char tag = *r->p++;
+  uint64_t v;
+  size_t len;
+  switch (tag) {
+  case TAG_NULL:
+  case TAG_FALSE:
+  case TAG_TRUE:
+    return 1;
+  case TAG_INT:
+    return get_varint(r, &v);
+  case TAG_DOUBLE:
+    if (r->end - r->p < 8) {
+      return 0;
+    }
+    r->p += 8;
+    return 1;
+  case TAG_STRING:
+    if (!get_size(r, &len)) {
+      return 0;
+    }
+    r->p += len;
+    return 1;
+  case TAG_ARRAY:
+  case TAG_OBJECT:
+  case TAG_OBJECT16:
+  case TAG_OBJECT32:
+    if (!get_varint(r, &v) || !get_size(r, &len)) {
+      return 0;
+    }
+    r->p += len;
+    return 1;
+  }
+  return 0;
+}
+
+static cJSON *decode_value(reader *r);
+
+static cJSON *decode_array(reader *r) {
+  uint64_t count;
+  size_t size;
+  if (!get_varint(r, &count) || !get_size(r, &size)) {
+    return NULL;
+  }
+  reader body = {r->p, r->p + size};
+  r->p += size;
+  cJSON *array = cJSON_CreateArray();
+  for (uint64_t i = 0; i < count; i++) {
+    cJSON *item = decode_value(&body);
+    if (item == NULL) {
+      cJSON_Delete(array);
+      return NULL;
+    }
+    cJSON_AddItemToArray(array, item);
+  }
+  return array;
+}
+
+/* A NUL terminated copy of the next len bytes. All len of them, strndup
+ * would stop at a NUL inside. */
+static char *get_bytes(reader *r, size_t len) {
+  char *copy = malloc(len + 1);
+  memcpy(copy, r->p, len);
+  copy[len] = '\0';
+  r->p += len;
+  return copy;
+}
+
+static char *get_key(reader *r) {
+  size_t klen;
+  if (!get_size(r, &klen)) {
+    return NULL;
+  }
+  return get_bytes(r, klen);
+}
+
+static cJSON *decode_object(reader *r, int width) {
+  uint64_t count;
+  size_t size;
+  if (!get_varint(r, &count) || !get_size(r, &size) || count > size / width) {
+    return NULL;
+  }
+  // fields follow the offset table, in document order
+  reader body = {r->p + count * width, r->p + size};
+  r->p += size;
+  cJSON *object = cJSON_CreateObject();
+  for (uint64_t i = 0; i < count; i++) {
+    char *key = get_key(&body);
+    cJSON *item = key == NULL ? NULL : decode_value(&body);
+    if (item == NULL) {
+      free(key);
+      cJSON_Delete(object);
+      return NULL;
+    }
+    // same for the key, an object is an array of named items
+    item->string = key;
+    cJSON_AddItemToArray(object, item);
+  }
+  return object;
+}
+
+static cJSON *decode_value(reader *r) {
+  if (r->p >= r->end) {
+    return NULL;
+  }
+  unsigned char tag = *r->p++;
+  uint64_t v;
+  size_t len;
+  switch (tag) {
+  case TAG_NULL:
+    return cJSON_CreateNull();
+  case TAG_FALSE:
+    return cJSON_CreateFalse();
+  case TAG_TRUE:
+    return cJSON_CreateTrue();
+  case TAG_INT:
+    if (!get_varint(r, &v)) {
+      return NULL;
+    }
+    return cJSON_CreateNumber((double)(int64_t)((v >> 1) ^ -(v & 1)));
+  case TAG_DOUBLE: {
+    if (r->end - r->p < 8) {
+      return NULL;
+    }
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++) {
+      bits |= (uint64_t)r->p[i] << (8 * i);
+    }
+    r->p += 8;
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return cJSON_CreateNumber(d);
+  }
+  case TAG_STRING: {
+    if (!get_size(r, &len)) {
+      return NULL;
+    }
+    // hand the copy to the item rather than have cJSON copy it again
+    cJSON *item = cJSON_CreateNull();
+    item->type = cJSON_String;
+    item->valuestring = get_bytes(r, len);
+    return item;
+  }
+  case TAG_ARRAY:
+    return decode_array(r);
+  case TAG_OBJECT:
+  case TAG_OBJECT16:
+  case TAG_OBJECT32:
+    return decode_object(r, offset_width(tag));
+  }
+  return NULL;
+}
+
+static reader binary_reader(const char *data, size_t len) {
+  reader r = {(const unsigned char *)data + AROCKS_DOC_MAGIC_LEN,
+              (const unsigned char *)data + len};
+  return r;
+}
+
+/* Parse text that may not be NUL terminated (it is when arocks wrote it). */
+static cJSON *parse_text(const char *data, size_t len) {
+  if (len > 0 && data[len - 1] == '\0') {
+    return arocks_doc_parse(data);
+  }
+  char *text = strndup(data, len);
+  cJSON *doc = arocks_doc_parse(text);
+  free(text);
+  return doc;
+}
+
+cJSON *arocks_doc_load(const char *data, size_t len) {
+  if (data == NULL) {
+    return NULL;
+  }
+  if (!arocks_doc_is_binary(data, len)) {
+    return parse_text(data, len);
+  }
+  reader r = binary_reader(data, len);
+  return decode_value(&r);
+}
+
+/*
+** Field lookup
+*/
+
+/* Find the field named seg[0..len) in the object at r (just past its tag)
+ * by binary search of the offset table, leaving r at its value. */
+static int find_field(reader *r, int width, const char *seg, size_t seg_len) {
+  uint64_t count;
+  size_t size;
+  if (!get_varint(r, &count) || !get_size(r, &size) || count > size / width) {
+    return 0;
+  }
+  const unsigned char *table = r->p;
+  const unsigned char *fields = table + count * width;
+  const unsigned char *end = r->p + size;
+  size_t lo = 0, hi = (size_t)count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    uint32_t offset = get_offset(table + mid * width, width);
+    reader f = {fields + offset, end};
+    size_t klen;
+    if (fields + offset >= end || !get_size(&f, &klen)) {
+      return 0;
+    }
+    size_t n = klen < seg_len ? klen : seg_len;
+    int c = memcmp(f.p, seg, n);
+    if (c == 0) {
+      c = klen < seg_len ? -1 : klen > seg_len;
+    }
+    if (c == 0) {
+      r->p = f.p + klen;
+      r->end = end;
+      return 1;
+    }
+    if (c < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return 0;
+}
+
+/* Move r to item idx of the array at r (just past its tag). */
+static int find_item(reader *r, const char *seg, size_t seg_len) {
+  uint64_t count;
+  size_t size;
+  char *endp = NULL;
+  long idx = strtol(seg, &endp, 10);
+  if (endp != seg + seg_len || idx < 0 || !get_varint(r, &count) ||
+      (uint64_t)idx >= count || !get_size(r, &size)) {
+    return 0;
+  }
+  r->end = r->p + size;
+  for (long i = 0; i < idx; i++) {
+    if (!skip_value(r)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+cJSON *arocks_doc_load_path(const char *data, size_t len, const char *path) {
+  if (data == NULL) {
+    return NULL;
+  }
+  if (!arocks_doc_is_binary(data, len)) {
+    cJSON *doc = parse_text(data, len);
+    cJSON *item = json_path_get(doc, path);
+    cJSON *copy = item == NULL ? NULL : cJSON_Duplicate(item, 1);
+    cJSON_Delete(doc);
+    return copy;
+  }
+  if (*path == ':') {
+    path++;
+  }
+  reader r = binary_reader(data, len);
+  while (*path != '\0') {
+    const char *dot = strchr(path, '.');
+    size_t seg_len = dot == NULL ? strlen(path) : (size_t)(dot - path);
+    if (r.p >= r.end) {
+      return NULL;
+    }
+    unsigned char tag = *r.p++;
+    int found = 0;
+    if (tag == TAG_ARRAY) {
+      found = find_item(&r, path, seg_len);
+    } else if (tag >= TAG_OBJECT && tag <= TAG_OBJECT32) {
+      found = find_field(&r, offset_width(tag), path, seg_len);
+    }
+    if (!found) {
+      return NULL;
+    }
+    path += dot == NULL ? seg_len : seg_len + 1;
+  }
+  return decode_value(&r);
+}
+
+char *arocks_doc_text(const char *data, size_t len) {
+  if (!arocks_doc_is_binary(data, len)) {
+    return strndup(data, len);
+  }
+  cJSON *doc = arocks_doc_load(data, len);
+  if (doc == NULL) {
+    return strdup("");
+  }
+  char *text = cJSON_PrintUnformatted(doc);
+  cJSON_Delete(doc);
+  return text;
+}
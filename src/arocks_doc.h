@@ -0,0 +1,63 @@
+#ifndef ALVAREZ_ROCKS_DOC_H_
+#define ALVAREZ_ROCKS_DOC_H_
+
+#include <stddef.h>
+
+#include "cJSON.h"
+
+/*
+** Stored documents. A value is either text, JSON or EDN sniffed from the
+** text (EDN maps start with '{' followed by a keyword, JSON objects with
+** '{' followed by a quoted string), or a binary encoded cJSON tree. Every
+** value says which it is, so a DB can hold both.
+**
+** Binary documents start with AROCKS_DOC_MAGIC (0xff never starts UTF-8
+** text), then one encoded value:
+**
+**   0x00 null   0x01 false   0x02 true
+**   0x03 int     zigzag varint, for integral numbers within +/-2^53
+**   0x04 double  8 bytes, little-endian IEEE 754
+**   0x05 string  varint length, bytes
+**   0x06 array   varint count, varint size in bytes, items
+**   0x07 object  varint count, varint size in bytes, offset table, fields
+**   0x08, 0x09   the same with wider offsets
+**
+** A field is a varint key length, the key bytes and a value. The offset
+** table holds a little-endian offset (from the first field) per field, 1
+** byte wide for 0x07, 2 for 0x08 and 4 for 0x09, sorted by key, so one
+** field can be found by binary search and decoded without touching the
+** rest; the fields themselves stay in document order. Sizes let a reader
+** skip whole arrays and objects.
+*/
+
+#define AROCKS_DOC_MAGIC "\xff\x01"
+#define AROCKS_DOC_MAGIC_LEN 2
+
+/* Parse a text document, returns NULL if it's neither EDN nor JSON. */
+cJSON *arocks_doc_parse(const char *text);
+
+/* Whether a stored value is a binary document. */
+int arocks_doc_is_binary(const char *data, size_t len);
+
+/* Encode doc, returns a malloc'd buffer and its length in len. */
+char *arocks_doc_encode(const cJSON *doc, size_t *len);
+
+/* The stored form of doc: binary encoded if binary is set and doc is an
+ * object or array, unformatted JSON text (with its '\0') otherwise. Returns
+ * a malloc'd buffer and its length in len. */
+char *arocks_doc_store(const cJSON *doc, int binary, size_t *len);
+
+/* Decode a stored value of either kind, returns NULL if it's malformed
+ * (or text that isn't a document). */
+cJSON *arocks_doc_load(const char *data, size_t len);
+
+/* Decode just the field at a dotted path (see json_path.h) of a stored
+ * value, returns NULL if it isn't there. Binary documents are searched
+ * through their offset tables instead of being decoded whole. */
+cJSON *arocks_doc_load_path(const char *data, size_t len, const char *path);
+
+/* A stored value as text: binary documents become unformatted JSON, text
+ * is copied. Returns a malloc'd string. */
+char *arocks_doc_text(const char *data, size_t len);
+
+#endif // ALVAREZ_ROCKS_DOC_H_
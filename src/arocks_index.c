@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arocks.h"
+#include "arocks_doc.h"
+#include "arocks_index.h"
+#include "cJSON.h"
+#include "json_path.h"
+#include "key_codec.h"
+#include "rocksdb/c.h"
+
+/* ":color" and "color" are the same index */
+static const char *index_name(const char *path) {
+  return *path == ':' ? path + 1 : path;
+}
+
+static int find_index(const arocks_t *s, const char *path) {
+  path = index_name(path);
+  for (int i = 0; i < s->nindexes; i++) {
+    if (strcmp(s->indexes[i], path) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void add_index(arocks_t *s, const char *path) {
+  s->indexes = realloc(s->indexes, (s->nindexes + 1) * sizeof(char *));
+  s->indexes[s->nindexes++] = strdup(path);
+}
+
+/* AROCKS_INDEX_ENTRY path '\0', the prefix of every entry of the index */
+static void entry_prefix(key_buf_t *b, const char *path) {
+  b->len = 0;
+  key_buf_append(b, AROCKS_INDEX_ENTRY, strlen(AROCKS_INDEX_ENTRY));
+  key_buf_append(b, path, strlen(path) + 1);
+}
+
+/* Encode every indexable value of field, a document's field at path: the
+ * field itself, or each scalar element of an array. Each value goes in as
+ * one entry prefix plus value plus key, and fn is called with the finished
+ * entry. */
+typedef void (*entry_fn)(const key_buf_t *entry, void *ctx);
+
+static void each_entry(const char *path, const cJSON *field, const char *key,
+                       entry_fn fn, void *ctx) {
+  if (field == NULL) {
+    return;
+  }
+  const cJSON *single = cJSON_IsArray(field) ? NULL : field;
+  const cJSON *item = cJSON_IsArray(field) ? field->child : single;
+  key_buf_t entry;
+  key_buf_init(&entry);
+  for (; item != NULL; item = single != NULL ? NULL : item->next) {
+    entry_prefix(&entry, path);
+    if (key_codec_put(&entry, item) != 0) {
+      continue;
+    }
+    key_buf_append(&entry, key, strlen(key) + 1);
+    fn(&entry, ctx);
+  }
+  key_buf_free(&entry);
+}
+
+// entries go to the column family of the documents they index
+typedef struct entry_batch {
+  rocksdb_writebatch_t *batch;
+  rocksdb_column_family_handle_t *cf;
+} entry_batch;
+
+static void batch_put_entry(const key_buf_t *entry, void *ctx) {
+  entry_batch *eb = ctx;
+  rocksdb_writebatch_put_cf(eb->batch, eb->cf, entry->data, entry->len, "",
+                            0);
+}
+
+static void batch_delete_entry(const key_buf_t *entry, void *ctx) {
+  entry_batch *eb = ctx;
+  rocksdb_writebatch_delete_cf(eb->batch, eb->cf, entry->data, entry->len);
+}
+
+/*
+** Declarations
+*/
+
+void arocks_index_load(arocks_t *s) {
+  s->indexes = NULL;
+  s->nindexes = 0;
+  const char *meta = AROCKS_INDEX_META;
+  size_t meta_len = strlen(meta);
+
+  rocksdb_readoptions_t *readoptions = rocksdb_readoptions_create();
+  // ';' follows ':', so this bounds the scan to the declarations
+  char *upper = strdup(meta);
+  upper[meta_len - 1] = ';';
+  rocksdb_readoptions_set_iterate_upper_bound(readoptions, upper, meta_len);
+  // system keys aren't under any prefix the extractor knows of
+  rocksdb_readoptions_set_total_order_seek(readoptions, 1);
+  rocksdb_iterator_t *iter =
+      rocksdb_create_iterator_cf(s->db, readoptions, s->cf);
+  for (rocksdb_iter_seek(iter, meta, meta_len); rocksdb_iter_valid(iter);
+       rocksdb_iter_next(iter)) {
+    size_t klen;
+    const char *key = rocksdb_iter_key(iter, &klen);
+    char *path = strndup(key + meta_len, klen - meta_len);
+    add_index(s, path);
+    free(path);
+  }
+  char *err = NULL;
+  rocksdb_iter_get_error(iter, &err);
+  ERR(err);
+  rocksdb_iter_destroy(iter);
+  rocksdb_readoptions_destroy(readoptions);
+  free(upper);
+}
+
+void arocks_index_free(arocks_t *s) {
+  for (int i = 0; i < s->nindexes; i++) {
+    free(s->indexes[i]);
+  }
+  free(s->indexes);
+  s->indexes = NULL;
+  s->nindexes = 0;
+}
+
+long arocks_index_create(arocks_t *s, const char *path) {
+  path = index_name(path);
+  if (find_index(s, path) < 0) {
+    key_buf_t meta;
+    key_buf_init(&meta);
+    key_buf_append(&meta, AROCKS_INDEX_META, strlen(AROCKS_INDEX_META));
+    key_buf_append(&meta, path, strlen(path));
+    char *err = NULL;
+    rocksdb_put_cf(s->db, s->writeoptions, s->cf, meta.data, meta.len, "", 0,
+                   &err);
+    ERR(err);
+    key_buf_free(&meta);
+    add_index(s, path);
+  }
+  return arocks_index_build(s, path);
+}
+
+typedef struct build_state {
+  arocks_t *s;
+  const char *path;
+  rocksdb_writebatch_t *batch;
+  long n;
+} build_state;
+
+static void build_flush(build_state *st) {
+  char *err = NULL;
+  rocksdb_write(st->s->db, st->s->writeoptions, st->batch, &err);
+  ERR(err);
+  rocksdb_writebatch_clear(st->batch);
+}
+
+/* Values come raw, so binary documents only decode the indexed field. */
+static int build_doc(const char *key, size_t klen, const char *val,
+                     size_t vlen, void *ctx) {
+  (void)klen;
+  build_state *st = ctx;
+  cJSON *field = arocks_doc_load_path(val, vlen, st->path);
+  if (field == NULL) {
+    return 0;
+  }
+  entry_batch eb = {st->batch, st->s->cf};
+  each_entry(st->path, field, key, batch_put_entry, &eb);
+  cJSON_Delete(field);
+  st->n++;
+  if (rocksdb_writebatch_count(st->batch) >= 1000) {
+    build_flush(st);
+  }
+  return 0;
+}
+
+long arocks_index_build(arocks_t *s, const char *path) {
+  path = index_name(path);
+  key_buf_t lo, hi;
+  key_buf_init(&lo);
+  key_buf_init(&hi);
+  entry_prefix(&lo, path);
+  entry_prefix(&hi, path);
+  hi.data[hi.len - 1] = 0x01; // just past every entry of this index
+  char *err = NULL;
+  rocksdb_delete_range_cf(s->db, s->writeoptions, s->cf, lo.data, lo.len,
+                          hi.data, hi.len, &err);
+  ERR(err);
+  key_buf_free(&lo);
+  key_buf_free(&hi);
+
+  build_state st = {s, path, rocksdb_writebatch_create(), 0};
+  arocks_scan_opts_t opts = {NULL, NULL, 0, 0, 0, NULL, 1};
+  arocks_scan_each(s, &opts, build_doc, &st);
+  build_flush(&st);
+  rocksdb_writebatch_destroy(st.batch);
+  return st.n;
+}
+
+/*
+** Maintenance
+*/
+
+void arocks_index_update(arocks_t *s, rocksdb_writebatch_t *batch,
+                         const char *key, const cJSON *doc) {
+  if (s->nindexes == 0) {
+    return;
+  }
+  cJSON *old_doc = arocks_get_doc(s, key);
+  arocks_index_replace(s, batch, key, old_doc, doc);
+  cJSON_Delete(old_doc);
+}
+
+void arocks_index_replace(arocks_t *s, rocksdb_writebatch_t *batch,
+                          const char *key, const cJSON *old_doc,
+                          const cJSON *doc) {
+  entry_batch eb = {batch, s->cf};
+  for (int i = 0; old_doc != NULL && i < s->nindexes; i++) {
+    each_entry(s->indexes[i], json_path_get(old_doc, s->indexes[i]), key,
+               batch_delete_entry, &eb);
+  }
+  // a put after a delete of the same entry in one batch wins
+  for (int i = 0; doc != NULL && i < s->nindexes; i++) {
+    each_entry(s->indexes[i], json_path_get(doc, s->indexes[i]), key,
+               batch_put_entry, &eb);
+  }
+}
+
+/* A patch changes the field at path if it reaches it, or replaces (or
+ * deletes) one of the objects on the way down. */
+static int patch_reaches(const cJSON *patch, const char *path) {
+  const cJSON *item = patch;
+  while (cJSON_IsObject(item) && *path != '\0') {
+    const char *dot = strchr(path, '.');
+    size_t len = dot == NULL ? strlen(path) : (size_t)(dot - path);
+    const cJSON *child = item->child;
+    while (child != NULL && (strlen(child->string) != len ||
+                             strncmp(child->string, path, len) != 0)) {
+      child = child->next;
+    }
+    if (child == NULL) {
+      return 0;
+    }
+    item = child;
+    path += dot == NULL ? len : len + 1;
+  }
+  return 1;
+}
+
+int arocks_index_patch_touches(const arocks_t *s, const cJSON *patch) {
+  for (int i = 0; i < s->nindexes; i++) {
+    if (patch_reaches(patch, s->indexes[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* One path is the other or lies inside it, segment-wise. */
+static int paths_overlap(const char *a, const char *b) {
+  size_t alen = strlen(a);
+  size_t blen = strlen(b);
+  size_t n = alen < blen ? alen : blen;
+  if (strncmp(a, b, n) != 0) {
+    return 0;
+  }
+  return alen == blen || (alen > n ? a[n] : b[n]) == '.';
+}
+
+int arocks_index_path_touches(const arocks_t *s, const char *path) {
+  path = index_name(path);
+  for (int i = 0; i < s->nindexes; i++) {
+    if (paths_overlap(path, s->indexes[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+** Queries
+*/
+
+typedef struct match_state {
+  const key_buf_t *want;
+  int found;
+} match_state;
+
+static void match_entry(const key_buf_t *entry, void *ctx) {
+  match_state *m = ctx;
+  if (entry->len == m->want->len &&
+      memcmp(entry->data, m->want->data, entry->len) == 0) {
+    m->found = 1;
+  }
+}
+
+/* Whether the document at key still has the (encoded) value at path, that
+ * is the entry found for it isn't stale. */
+static int entry_current(const char *path, const char *doc_text,
+                         const key_buf_t *entry, const char *key) {
+  cJSON *doc = arocks_doc_parse(doc_text);
+  if (doc == NULL) {
+    return 0;
+  }
+  match_state m = {entry, 0};
+  each_entry(path, json_path_get(doc, path), key, match_entry, &m);
+  cJSON_Delete(doc);
+  return m.found;
+}
+
+#define QUERY_BATCH 256
+
+typedef struct query_batch {
+  char *keys[QUERY_BATCH];
+  key_buf_t entries[QUERY_BATCH];
+  arocks_view_t views[QUERY_BATCH];
+  size_t n;
+} query_batch;
+
+/* MultiGet the batch's primary keys and visit the current ones. Returns 0
+ * to keep going, 1 once the visitor or the limit says stop. */
+static int query_resolve(arocks_t *s, const char *path, query_batch *b,
+                         long limit, long *visited, arocks_visit_fn fn,
+                         void *ctx) {
+  int stop = 0;
+  arocks_multi_get_pinned(s, b->n, (const char *const *)b->keys, b->views);
+  for (size_t i = 0; i < b->n; i++) {
+    arocks_view_t *v = &b->views[i];
+    if (v->data != NULL && !stop &&
+        entry_current(path, v->data, &b->entries[i], b->keys[i])) {
+      (*visited)++;
+      stop = fn(b->keys[i], strlen(b->keys[i]), v->data, v->len, ctx) != 0 ||
+             (limit > 0 && *visited >= limit);
+    }
+    if (v->data != NULL) {
+      arocks_release(v);
+    }
+    free(b->keys[i]);
+    key_buf_free(&b->entries[i]);
+  }
+  b->n = 0;
+  return stop;
+}
+
+long arocks_index_query(arocks_t *s, const char *path, const cJSON *lo,
+                        const cJSON *hi, long limit, arocks_visit_fn fn,
+                        void *ctx) {
+  path = index_name(path);
+  if (find_index(s, path) < 0) {
+    return -1;
+  }
+  key_buf_t start, end;
+  key_buf_init(&start);
+  key_buf_init(&end);
+  entry_prefix(&start, path);
+  size_t prefix_len = start.len;
+  if (lo != NULL) {
+    key_codec_put(&start, lo);
+  }
+  entry_prefix(&end, path);
+  if (hi != NULL && key_codec_put(&end, hi) == 0) {
+    // past every key filed under hi, UTF-8 keys never hold a 0xff byte
+    key_buf_append(&end, "\xff", 1);
+  } else {
+    end.data[end.len - 1] = 0x01;
+  }
+
+  rocksdb_readoptions_t *readoptions = rocksdb_readoptions_create();
+  rocksdb_readoptions_set_iterate_upper_bound(readoptions, end.data, end.len);
+  rocksdb_readoptions_set_total_order_seek(readoptions, 1);
+  rocksdb_iterator_t *iter =
+      rocksdb_create_iterator_cf(s->db, readoptions, s->cf);
+  query_batch *b = malloc(sizeof(query_batch));
+  b->n = 0;
+  long visited = 0;
+  int stop = 0;
+  for (rocksdb_iter_seek(iter, start.data, start.len);
+       !stop && rocksdb_iter_valid(iter); rocksdb_iter_next(iter)) {
+    size_t klen;
+    const char *k = rocksdb_iter_key(iter, &klen);
+    size_t vlen = key_codec_len(k + prefix_len, klen - prefix_len);
+    if (vlen == 0 || klen - prefix_len - vlen == 0) {
+      continue;
+    }
+    const char *pk = k + prefix_len + vlen;
+    b->keys[b->n] = strndup(pk, klen - prefix_len - vlen);
+    key_buf_init(&b->entries[b->n]);
+    key_buf_append(&b->entries[b->n], k, klen);
+    b->n++;
+    // don't fetch more than the limit could still use
+    if (b->n == QUERY_BATCH || (limit > 0 && visited + (long)b->n >= limit)) {
+      stop = query_resolve(s, path, b, limit, &visited, fn, ctx);
+    }
+  }
+  if (!stop && b->n > 0) {
+    query_resolve(s, path, b, limit, &visited, fn, ctx);
+  }
+  char *err = NULL;
+  rocksdb_iter_get_error(iter, &err);
+  ERR(err);
+  rocksdb_iter_destroy(iter);
+  rocksdb_readoptions_destroy(readoptions);
+  free(b);
+  key_buf_free(&start);
+  key_buf_free(&end);
+  return visited;
+}
@@ -0,0 +1,64 @@
+#ifndef ALVAREZ_ROCKS_INDEX_H_
+#define ALVAREZ_ROCKS_INDEX_H_
+
+#include "arocks.h"
+#include "cJSON.h"
+#include "rocksdb/c.h"
+
+/*
+** Secondary indexes on document fields. An index is declared on a dotted
+** field path (":color", "stats.views") and stored in the DB, so every
+** session opened on it maintains the index from then on. Index entries live
+** under the system prefix, past every user key:
+**
+**   AROCKS_SYS_PREFIX "meta:index:" path              -> declaration
+**   AROCKS_SYS_PREFIX "idx:" path '\0' value key '\0' -> ""
+**
+** with value in key_codec's order-preserving encoding, so a range of field
+** values is a range of entries. Array fields get one entry per element.
+** Entries are written in the same WriteBatch as the document itself.
+*/
+
+#define AROCKS_INDEX_META AROCKS_SYS_PREFIX "meta:index:"
+#define AROCKS_INDEX_ENTRY AROCKS_SYS_PREFIX "idx:"
+
+/* Read the declared indexes into s, called from arocks_open_with. */
+void arocks_index_load(arocks_t *s);
+void arocks_index_free(arocks_t *s);
+
+/* Declare an index on path (if it isn't already) and build it from the
+ * documents already stored. Returns the number of documents that have the
+ * field. */
+long arocks_index_create(arocks_t *s, const char *path);
+
+/* Drop and rebuild the entries of one declared index, for writes that
+ * bypass arocks_put such as SST ingestion. */
+long arocks_index_build(arocks_t *s, const char *path);
+
+/* Add the index changes for writing doc (NULL for a delete) at key to
+ * batch: the stored document's entries are removed and doc's added. */
+void arocks_index_update(arocks_t *s, rocksdb_writebatch_t *batch,
+                         const char *key, const cJSON *doc);
+/* The same given the stored document (NULL for none), for callers that
+ * read it themselves. */
+void arocks_index_replace(arocks_t *s, rocksdb_writebatch_t *batch,
+                          const char *key, const cJSON *old_doc,
+                          const cJSON *doc);
+
+/* Whether a merge patch, or an increment at path, could change an indexed
+ * field, in which case its index changes have to be worked out up front. */
+int arocks_index_patch_touches(const arocks_t *s, const cJSON *patch);
+int arocks_index_path_touches(const arocks_t *s, const char *path);
+
+/*
+** Visit the documents whose field at path is between lo and hi (inclusive,
+** NULL for no bound), in field order, up to limit of them (0 for all).
+** Primary keys are resolved in MultiGet batches, and each document is
+** checked against its entry so a stale entry is never returned. Returns
+** the number visited, or -1 if path isn't indexed.
+*/
+long arocks_index_query(arocks_t *s, const char *path, const cJSON *lo,
+                        const cJSON *hi, long limit, arocks_visit_fn fn,
+                        void *ctx);
+
+#endif // ALVAREZ_ROCKS_INDEX_H_
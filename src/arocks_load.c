@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arocks.h"
+#include "arocks_doc.h"
+#include "arocks_index.h"
+#include "arocks_load.h"
+#include "cJSON.h"
+#include "edn_parse.h"
+#include "json_path.h"
+
+arocks_load_opts_t arocks_load_defaults(const char *path,
+                                        const char *key_field) {
+  arocks_load_opts_t opts;
+  size_t len = strlen(path);
+  opts.key_field = key_field;
+  opts.format = (len > 4 && strcmp(path + len - 4, ".edn") == 0)
+                    ? AROCKS_LOAD_EDN
+                    : AROCKS_LOAD_JSONL;
+  opts.batch_size = 1000;
+  opts.disable_wal = 0;
+  opts.sst_dir = NULL;
+  opts.sst_file_bytes = 256 << 20;
+  opts.typed_keys = 0;
+  return opts;
+}
+
+/*
+** Reading documents
+*/
+
+typedef struct doc_reader {
+  const arocks_load_opts_t *opts;
+  arocks_doc_fn fn;
+  void *ctx;
+  long n;       // documents handed to fn
+  long skipped; // documents without a usable key
+  int stop;
+} doc_reader;
+
+/* Typed key text for an id, which may also be an array (a tuple key). */
+static char *typed_key_text(const cJSON *id) {
+  key_buf_t b;
+  key_buf_init(&b);
+  char *key = NULL;
+  if (id != NULL && key_codec_put(&b, id) == 0) {
+    key = key_codec_text(b.data, b.len);
+  }
+  key_buf_free(&b);
+  return key;
+}
+
+/* Hand one parsed document to the callback, takes ownership of doc. */
+static void reader_doc(doc_reader *r, cJSON *doc) {
+  const cJSON *id = json_path_get(doc, r->opts->key_field);
+  char *key = r->opts->typed_keys ? typed_key_text(id)
+                                  : json_path_key_text(id);
+  if (key == NULL) {
+    r->skipped++;
+  } else {
+    r->stop = r->fn(key, doc, r->ctx);
+    r->n++;
+    free(key);
+  }
+  cJSON_Delete(doc);
+}
+
+static int read_jsonl(doc_reader *r, FILE *fp) {
+  char *line = NULL;
+  size_t cap = 0;
+  long lineno = 0;
+  while (!r->stop && getline(&line, &cap, fp) != -1) {
+    lineno++;
+    const char *p = line;
+    while (*p != '\0' && (unsigned char)*p <= 32) {
+      p++;
+    }
+    if (*p == '\0') {
+      continue; // blank line
+    }
+    cJSON *doc = cJSON_Parse(p);
+    if (doc == NULL) {
+      fprintf(stderr, "Skipping line %ld: invalid JSON\n", lineno);
+      r->skipped++;
+      continue;
+    }
+    reader_doc(r, doc);
+  }
+  free(line);
+  return 0;
+}
+
+static char *read_all(FILE *fp, size_t *len) {
+  size_t cap = 1 << 16;
+  size_t n = 0;
+  char *buf = malloc(cap);
+  size_t got;
+  while ((got = fread(buf + n, 1, cap - n - 1, fp)) > 0) {
+    n += got;
+    if (n + 1 == cap) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+  }
+  buf[n] = '\0';
+  *len = n;
+  return buf;
+}
+
+/*
+** An EDN file is a sequence of forms. A top level vector is treated as a
+** sequence of documents too.
+*/
+static int read_edn(doc_reader *r, FILE *fp) {
+  size_t len;
+  char *text = read_all(fp, &len);
+  const char *p = text;
+  const char *end = text + len;
+  while (!r->stop) {
+    while (p < end && (unsigned char)*p <= 32) {
+      p++;
+    }
+    if (p >= end) {
+      break;
+    }
+    const char *next = NULL;
+    // length includes the trailing '\0', as edn_parse would pass
+    cJSON *form = edn_ParseWithLengthOpts(p, (size_t)(end - p) + 1, &next, 0);
+    if (form == NULL) {
+      fprintf(stderr, "Stopping at offset %ld: invalid EDN\n",
+              (long)(next == NULL ? p - text : next - text));
+      free(text);
+      return -1;
+    }
+    p = next;
+    if (cJSON_IsArray(form)) {
+      cJSON *doc;
+      while (!r->stop && (doc = cJSON_DetachItemFromArray(form, 0)) != NULL) {
+        reader_doc(r, doc);
+      }
+      cJSON_Delete(form);
+    } else {
+      reader_doc(r, form);
+    }
+  }
+  free(text);
+  return 0;
+}
+
+long arocks_load_each(const char *path, const arocks_load_opts_t *opts,
+                      arocks_doc_fn fn, void *ctx) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    perror("Error opening file");
+    return -1;
+  }
+  doc_reader r = {opts, fn, ctx, 0, 0, 0};
+  int rc = opts->format == AROCKS_LOAD_EDN ? read_edn(&r, fp)
+                                           : read_jsonl(&r, fp);
+  fclose(fp);
+  if (r.skipped > 0) {
+    fprintf(stderr, "Skipped %ld documents without a usable %s\n", r.skipped,
+            opts->key_field);
+  }
+  return rc < 0 ? -1 : r.n;
+}
+
+/*
+** WriteBatch import
+*/
+
+typedef struct import_state {
+  arocks_t *s;
+  rocksdb_writebatch_t *batch;
+  rocksdb_writeoptions_t *writeoptions;
+  long batch_size;
+  long pending; // documents in the batch
+  long written; // ... in batches already written
+  key_buf_t key; // reused for encoding keys
+} import_state;
+
+static void import_flush(import_state *st) {
+  if (rocksdb_writebatch_count(st->batch) == 0) {
+    return;
+  }
+  char *err = NULL;
+  rocksdb_write(st->s->db, st->writeoptions, st->batch, &err);
+  ERR(err);
+  st->written += st->pending;
+  st->pending = 0;
+  rocksdb_writebatch_clear(st->batch);
+}
+
+static int import_doc(const char *key, const cJSON *doc, void *ctx) {
+  import_state *st = ctx;
+  // a key repeated within one batch can leave a stale entry behind, which
+  // queries check for and skip
+  arocks_index_update(st->s, st->batch, key, doc);
+  size_t vlen;
+  char *value = arocks_doc_store(doc, st->s->config.binary_docs, &vlen);
+  size_t klen;
+  const char *k = arocks_key_encode(st->s, key, &st->key, &klen);
+  rocksdb_writebatch_put_cf(st->batch, st->s->cf, k, klen, value, vlen);
+  st->pending++;
+  free(value);
+  if (rocksdb_writebatch_count(st->batch) >= st->batch_size) {
+    import_flush(st);
+  }
+  return 0;
+}
+
+long arocks_import(arocks_t *s, const char *path,
+                   const arocks_load_opts_t *opts) {
+  import_state st;
+  st.s = s;
+  st.batch = rocksdb_writebatch_create();
+  key_buf_init(&st.key);
+  st.writeoptions = rocksdb_writeoptions_create();
+  st.batch_size = opts->batch_size > 0 ? opts->batch_size : 1;
+  st.pending = 0;
+  st.written = 0;
+  rocksdb_writeoptions_disable_WAL(st.writeoptions, opts->disable_wal);
+
+  long n = arocks_load_each(path, opts, import_doc, &st);
+  if (n >= 0) {
+    import_flush(&st);
+  } else {
+    fprintf(stderr, "Import stopped, %ld documents written before it\n",
+            st.written);
+  }
+
+  if (opts->disable_wal) {
+    // nothing imported is durable until the memtables hit disk
+    char *err = NULL;
+    rocksdb_flushoptions_t *flushoptions = rocksdb_flushoptions_create();
+    rocksdb_flushoptions_set_wait(flushoptions, 1);
+    rocksdb_flush_cf(s->db, flushoptions, s->cf, &err);
+    ERR(err);
+    rocksdb_flushoptions_destroy(flushoptions);
+  }
+
+  rocksdb_writeoptions_destroy(st.writeoptions);
+  rocksdb_writebatch_destroy(st.batch);
+  key_buf_free(&st.key);
+  return n;
+}
+
+/*
+** SST file ingestion
+*/
+
+typedef struct sst_entry {
+  char *key; // stored form
+  size_t klen;
+  char *value;
+  size_t vlen; // binary documents hold NULs
+  long seq;    // input order, so the last duplicate can win
+} sst_entry;
+
+typedef struct sst_state {
+  arocks_t *s;
+  sst_entry *entries;
+  long n;
+  long cap;
+} sst_state;
+
+static int collect_doc(const char *key, const cJSON *doc, void *ctx) {
+  sst_state *st = ctx;
+  if (st->n == st->cap) {
+    st->cap = st->cap == 0 ? 1024 : st->cap * 2;
+    st->entries = realloc(st->entries, st->cap * sizeof(sst_entry));
+  }
+  sst_entry *e = &st->entries[st->n];
+  key_buf_t kb;
+  key_buf_init(&kb);
+  const char *k = arocks_key_encode(st->s, key, &kb, &e->klen);
+  e->key = malloc(e->klen);
+  memcpy(e->key, k, e->klen);
+  key_buf_free(&kb);
+  e->value = arocks_doc_store(doc, st->s->config.binary_docs, &e->vlen);
+  e->seq = st->n;
+  st->n++;
+  return 0;
+}
+
+/* SST files have to be written in the DB's key order. qsort passes no
+ * context, so the session to sort for is set before each sort. */
+static const arocks_t *sst_sort_session;
+
+static int sst_key_cmp(const sst_entry *x, const sst_entry *y) {
+  return arocks_key_compare(sst_sort_session, x->key, x->klen, y->key,
+                            y->klen);
+}
+
+static int sst_entry_cmp(const void *a, const void *b) {
+  const sst_entry *x = a;
+  const sst_entry *y = b;
+  int c = sst_key_cmp(x, y);
+  if (c != 0) {
+    return c;
+  }
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static char *sst_file_name(const char *dir, int n) {
+  size_t len = strlen(dir) + 32;
+  char *name = malloc(len);
+  snprintf(name, len, "%s/load-%06d.sst", dir, n);
+  return name;
+}
+
+long arocks_load_sst(arocks_t *s, const char *path,
+                     const arocks_load_opts_t *opts) {
+  sst_state st = {s, NULL, 0, 0};
+  if (arocks_load_each(path, opts, collect_doc, &st) < 0) {
+    for (long i = 0; i < st.n; i++) {
+      free(st.entries[i].key);
+      free(st.entries[i].value);
+    }
+    free(st.entries);
+    return -1;
+  }
+  sst_sort_session = s;
+  qsort(st.entries, st.n, sizeof(sst_entry), sst_entry_cmp);
+
+  const char *dir = opts->sst_dir != NULL ? opts->sst_dir : "sst-load";
+  mkdir(dir, 0755);
+
+  char *err = NULL;
+  char **files = NULL;
+  int nfiles = 0;
+  long nkeys = 0;
+  size_t file_bytes = 0;
+  rocksdb_envoptions_t *envoptions = rocksdb_envoptions_create();
+  rocksdb_sstfilewriter_t *writer = NULL;
+
+  for (long i = 0; i < st.n; i++) {
+    sst_entry *e = &st.entries[i];
+    // sorted by (key, seq) so only the last of a run of duplicates is kept
+    int dup = i + 1 < st.n && sst_key_cmp(e, &st.entries[i + 1]) == 0;
+    if (!dup) {
+      if (writer == NULL) {
+        files = realloc(files, (nfiles + 1) * sizeof(char *));
+        files[nfiles] = sst_file_name(dir, nfiles);
+        writer = rocksdb_sstfilewriter_create(envoptions, s->options);
+        rocksdb_sstfilewriter_open(writer, files[nfiles], &err);
+        ERR(err);
+        nfiles++;
+        file_bytes = 0;
+      }
+      rocksdb_sstfilewriter_put(writer, e->key, e->klen, e->value, e->vlen,
+                                &err);
+      ERR(err);
+      file_bytes += e->klen + e->vlen;
+      nkeys++;
+      if (file_bytes >= opts->sst_file_bytes) {
+        rocksdb_sstfilewriter_finish(writer, &err);
+        ERR(err);
+        rocksdb_sstfilewriter_destroy(writer);
+        writer = NULL;
+      }
+    }
+    free(e->key);
+    free(e->value);
+  }
+  if (writer != NULL) {
+    rocksdb_sstfilewriter_finish(writer, &err);
+    ERR(err);
+    rocksdb_sstfilewriter_destroy(writer);
+  }
+  free(st.entries);
+
+  if (nfiles > 0) {
+    // files are sorted and don't overlap, so they go in as one ingest
+    rocksdb_ingestexternalfileoptions_t *ingestoptions =
+        rocksdb_ingestexternalfileoptions_create();
+    rocksdb_ingestexternalfileoptions_set_move_files(ingestoptions, 1);
+    rocksdb_ingest_external_file_cf(s->db, s->cf, (const char *const *)files,
+                                    nfiles, ingestoptions, &err);
+    ERR(err);
+    rocksdb_ingestexternalfileoptions_destroy(ingestoptions);
+  }
+
+  for (int i = 0; i < nfiles; i++) {
+    unlink(files[i]); // already moved in, unless linking fell back to a copy
+    free(files[i]);
+  }
+  free(files);
+  rmdir(dir);
+  rocksdb_envoptions_destroy(envoptions);
+
+  // ingestion bypasses index maintenance, so rebuild every index
+  for (int i = 0; nfiles > 0 && i < s->nindexes; i++) {
+    arocks_index_build(s, s->indexes[i]);
+  }
+  return nkeys;
+}
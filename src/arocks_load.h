@@ -0,0 +1,57 @@
+#ifndef ALVAREZ_ROCKS_LOAD_H_
+#define ALVAREZ_ROCKS_LOAD_H_
+
+#include "arocks.h"
+#include "cJSON.h"
+
+/*
+** Bulk loading of documents from JSON Lines (one document per line) or EDN
+** (any number of forms, whitespace separated) files. Each document's key is
+** pulled from key_field, a json_path like "id" or ":color".
+*/
+
+#define AROCKS_LOAD_JSONL 0
+#define AROCKS_LOAD_EDN 1
+
+typedef struct arocks_load_opts {
+  const char *key_field;
+  int format;        // AROCKS_LOAD_JSONL or AROCKS_LOAD_EDN
+  long batch_size;   // documents per WriteBatch
+  int disable_wal;   // skip the WAL while importing, flush at the end
+  const char *sst_dir;   // scratch directory for SST files (sst loads only)
+  size_t sst_file_bytes; // roll over to a new SST file past this size
+  int typed_keys; // keys are typed (AROCKS_KEYS_TYPED), so arrays are ids
+} arocks_load_opts_t;
+
+/* Defaults, with the format guessed from the file extension. */
+arocks_load_opts_t arocks_load_defaults(const char *path,
+                                        const char *key_field);
+
+/* Called once per document that has a key, return non-zero to stop. */
+typedef int (*arocks_doc_fn)(const char *key, const cJSON *doc, void *ctx);
+
+/* Read every document in path, returns the number handed to fn or -1 if the
+ * file can't be read or an EDN form in it can't be parsed, which stops the
+ * read there. Documents without a key, and JSON Lines that aren't JSON, are
+ * skipped. */
+long arocks_load_each(const char *path, const arocks_load_opts_t *opts,
+                      arocks_doc_fn fn, void *ctx);
+
+/* Import every document in path through WriteBatches, returns the number of
+ * documents written or -1 if the file can't be read or parsed. Batches
+ * written before a parse error stay written, the one in progress doesn't. */
+long arocks_import(arocks_t *s, const char *path,
+                   const arocks_load_opts_t *opts);
+
+/*
+** Offline load: sort every document by key, write them into SST files with
+** the session's options and ingest those files directly, skipping the
+** memtable, WAL and compaction rewrites. The whole input is held in memory
+** while sorting. Later duplicates of a key win, and declared indexes are
+** rebuilt afterwards. Returns the number of keys ingested or -1 if the file
+** can't be read.
+*/
+long arocks_load_sst(arocks_t *s, const char *path,
+                     const arocks_load_opts_t *opts);
+
+#endif // ALVAREZ_ROCKS_LOAD_H_
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arocks_doc.h"
+#include "arocks_merge.h"
+#include "cJSON.h"
+#include "json_path.h"
+#include "rocksdb/c.h"
+
+/*
+** Merge patches
+*/
+
+cJSON *json_merge_patch(cJSON *target, const cJSON *patch) {
+  if (!cJSON_IsObject(patch)) {
+    // anything but an object replaces the target outright
+    cJSON_Delete(target);
+    return cJSON_Duplicate(patch, 1);
+  }
+  if (!cJSON_IsObject(target)) {
+    cJSON_Delete(target);
+    target = cJSON_CreateObject();
+  }
+  const cJSON *field;
+  cJSON_ArrayForEach(field, patch) {
+    cJSON *old = cJSON_GetObjectItemCaseSensitive(target, field->string);
+    if (cJSON_IsNull(field)) {
+      cJSON_Delete(cJSON_DetachItemViaPointer(target, old));
+    } else if (old == NULL) {
+      cJSON_AddItemToObject(target, field->string,
+                            json_merge_patch(NULL, field));
+    } else if (cJSON_IsObject(old) && cJSON_IsObject(field)) {
+      // patched in place, keeping the field where it was
+      json_merge_patch(old, field);
+    } else {
+      cJSON_ReplaceItemViaPointer(target, old, cJSON_Duplicate(field, 1));
+    }
+  }
+  return target;
+}
+
+/* Fold patch b into patch a, so applying a alone does what applying a then
+ * b would. Returns 0 when the two can't be combined into one patch: if a
+ * deletes or overwrites a field with a scalar that b then patches, the
+ * combined step would need "replace with" semantics a patch can't express. */
+static int compose_patch(cJSON *a, const cJSON *b) {
+  const cJSON *field;
+  cJSON_ArrayForEach(field, b) {
+    cJSON *old = cJSON_GetObjectItemCaseSensitive(a, field->string);
+    if (old == NULL) {
+      cJSON_AddItemToObject(a, field->string, cJSON_Duplicate(field, 1));
+    } else if (!cJSON_IsObject(field)) {
+      cJSON_ReplaceItemViaPointer(a, old, cJSON_Duplicate(field, 1));
+    } else if (!cJSON_IsObject(old) || !compose_patch(old, field)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+** Operands
+*/
+
+/* Values may be binary documents or text, operands are always text. EDN
+ * documents come out of a merge as JSON. */
+static cJSON *parse_slice(const char *data, size_t len) {
+  return arocks_doc_load(data, len);
+}
+
+static char *print_slice(const cJSON *doc, size_t *len) {
+  char *text = cJSON_PrintUnformatted(doc);
+  *len = strlen(text) + 1;
+  return text;
+}
+
+static int is_increment(const char *data, size_t len) {
+  return len > 0 && data[0] == '+';
+}
+
+/* Split "+<delta> <path>" into its parts, path points into data and runs to
+ * the end of the slice (less any trailing NUL). Returns 0 if malformed. */
+static int parse_increment(const char *data, size_t len, double *delta,
+                           const char **path, size_t *path_len) {
+  const char *space = memchr(data, ' ', len);
+  if (space == NULL) {
+    return 0;
+  }
+  char num[64];
+  size_t num_len = (size_t)(space - data) - 1;
+  if (num_len == 0 || num_len >= sizeof(num)) {
+    return 0;
+  }
+  memcpy(num, data + 1, num_len);
+  num[num_len] = '\0';
+  char *end = NULL;
+  *delta = strtod(num, &end);
+  if (*end != '\0') {
+    return 0;
+  }
+  *path = space + 1;
+  *path_len = len - (size_t)(*path - data);
+  if (*path_len > 0 && (*path)[*path_len - 1] == '\0') {
+    (*path_len)--;
+  }
+  return *path_len > 0;
+}
+
+char *arocks_increment_operand(const char *path, double delta, size_t *len) {
+  // ":stats.views" and "stats.views" are the same field, so they fold
+  if (*path == ':') {
+    path++;
+  }
+  size_t path_len = strlen(path);
+  char *op = cJSON_malloc(path_len + 32);
+  int n = snprintf(op, 32, "+%.17g ", delta);
+  memcpy(op + n, path, path_len + 1);
+  *len = (size_t)n + path_len + 1;
+  return op;
+}
+
+/* Add delta to the number at path, a missing or non-numeric field counts as
+ * 0. Takes ownership of doc, which becomes an object if it isn't one. */
+static cJSON *apply_increment(cJSON *doc, const char *path, size_t path_len,
+                              double delta) {
+  if (!cJSON_IsObject(doc)) {
+    cJSON_Delete(doc);
+    doc = cJSON_CreateObject();
+  }
+  char *p = strndup(path, path_len);
+  const cJSON *cur = json_path_get(doc, p);
+  double value = cJSON_IsNumber(cur) ? cur->valuedouble : 0;
+  // a bad array index drops the increment, like a malformed operand
+  json_path_set(doc, p, cJSON_CreateNumber(value + delta));
+  free(p);
+  return doc;
+}
+
+cJSON *arocks_merge_apply(cJSON *doc, const char *operand, size_t len) {
+  if (is_increment(operand, len)) {
+    double delta;
+    const char *path;
+    size_t path_len;
+    if (parse_increment(operand, len, &delta, &path, &path_len)) {
+      doc = apply_increment(doc, path, path_len, delta);
+    }
+    return doc;
+  }
+  cJSON *patch = parse_slice(operand, len);
+  if (patch == NULL) {
+    // arocks_merge callers validate patches, skip anything else rather than
+    // fail every read of the key
+    return doc;
+  }
+  doc = json_merge_patch(doc, patch);
+  cJSON_Delete(patch);
+  return doc;
+}
+
+/*
+** Merge operator callbacks
+*/
+
+static char *full_merge(void *state, const char *key, size_t key_length,
+                        const char *existing_value,
+                        size_t existing_value_length,
+                        const char *const *operands_list,
+                        const size_t *operands_list_length, int num_operands,
+                        unsigned char *success, size_t *new_value_length) {
+  (void)key;
+  (void)key_length;
+  cJSON *doc = parse_slice(existing_value, existing_value_length);
+  for (int i = 0; i < num_operands; i++) {
+    doc = arocks_merge_apply(doc, operands_list[i], operands_list_length[i]);
+  }
+  if (doc == NULL) {
+    doc = cJSON_CreateObject();
+  }
+  // state is the binary documents flag
+  char *result = arocks_doc_store(doc, state != NULL, new_value_length);
+  cJSON_Delete(doc);
+  *success = 1;
+  return result;
+}
+
+/* Sum a run of increments that all target the same path into one. */
+static char *partial_increment(const char *const *operands_list,
+                               const size_t *operands_list_length,
+                               int num_operands, unsigned char *success,
+                               size_t *new_value_length) {
+  double total = 0;
+  const char *first_path = NULL;
+  size_t first_len = 0;
+  for (int i = 0; i < num_operands; i++) {
+    double delta;
+    const char *path;
+    size_t path_len;
+    if (!is_increment(operands_list[i], operands_list_length[i]) ||
+        !parse_increment(operands_list[i], operands_list_length[i], &delta,
+                         &path, &path_len)) {
+      return NULL;
+    }
+    if (first_path == NULL) {
+      first_path = path;
+      first_len = path_len;
+    } else if (path_len != first_len ||
+               memcmp(path, first_path, path_len) != 0) {
+      // increments on different fields stay separate operands
+      return NULL;
+    }
+    total += delta;
+  }
+  char *p = strndup(first_path, first_len);
+  char *result = arocks_increment_operand(p, total, new_value_length);
+  free(p);
+  *success = 1;
+  return result;
+}
+
+static char *partial_merge(void *state, const char *key, size_t key_length,
+                           const char *const *operands_list,
+                           const size_t *operands_list_length,
+                           int num_operands, unsigned char *success,
+                           size_t *new_value_length) {
+  (void)state;
+  (void)key;
+  (void)key_length;
+  *success = 0;
+  if (is_increment(operands_list[0], operands_list_length[0])) {
+    return partial_increment(operands_list, operands_list_length,
+                             num_operands, success, new_value_length);
+  }
+  cJSON *acc = parse_slice(operands_list[0], operands_list_length[0]);
+  for (int i = 1; acc != NULL && i < num_operands; i++) {
+    cJSON *patch = parse_slice(operands_list[i], operands_list_length[i]);
+    if (patch == NULL ||
+        (cJSON_IsObject(patch) &&
+         (!cJSON_IsObject(acc) || !compose_patch(acc, patch)))) {
+      // leave the operands for a full merge to apply one by one
+      cJSON_Delete(patch);
+      cJSON_Delete(acc);
+      return NULL;
+    }
+    if (!cJSON_IsObject(patch)) {
+      // a non-object patch replaces whatever came before it
+      cJSON_Delete(acc);
+      acc = patch;
+    } else {
+      cJSON_Delete(patch);
+    }
+  }
+  if (acc == NULL) {
+    return NULL;
+  }
+  char *result = print_slice(acc, new_value_length);
+  cJSON_Delete(acc);
+  *success = 1;
+  return result;
+}
+
+static void delete_value(void *state, const char *value, size_t value_length) {
+  (void)state;
+  (void)value_length;
+  cJSON_free((void *)value);
+}
+
+static void destroy(void *state) { (void)state; }
+
+static const char *name(void *state) {
+  (void)state;
+  return "modric.json_merge";
+}
+
+rocksdb_mergeoperator_t *arocks_merge_operator(int binary) {
+  return rocksdb_mergeoperator_create(binary ? (void *)1 : NULL, destroy,
+                                      full_merge, partial_merge, delete_value,
+                                      name);
+}
@@ -0,0 +1,44 @@
+#ifndef ALVAREZ_ROCKS_MERGE_H_
+#define ALVAREZ_ROCKS_MERGE_H_
+
+#include "cJSON.h"
+#include "rocksdb/c.h"
+
+/*
+** JSON merge operator. Merge operands are JSON merge patches (RFC 7396)
+** that RocksDB folds into the stored document lazily, on reads and during
+** compaction, so a partial update is one blind write instead of a
+** get/modify/put round trip:
+**
+**   {"status": "active", "stats": {"views": 10}, "draft": null}
+**
+** sets status and stats.views, leaves the rest of the document alone and
+** removes draft. A stored value that isn't JSON counts as no document.
+**
+** An operand of the form "+<delta> <path>" instead adds delta to the number
+** at a dotted path (see json_path.h), treating a missing field as 0:
+**
+**   +1 :stats.views
+**
+** Concurrent increments need no read-modify-write and can't lose updates;
+** RocksDB sums runs of them on the same field during compaction.
+*/
+
+/* A new operator for rocksdb_options_set_merge_operator, which takes
+ * ownership of it. Merged objects and arrays are written binary encoded
+ * (see arocks_doc.h) if binary is set, as JSON text otherwise. */
+rocksdb_mergeoperator_t *arocks_merge_operator(int binary);
+
+/* Encode an increment operand, returns a cJSON_malloc'd buffer and its
+ * length (with the trailing NUL) in len. */
+char *arocks_increment_operand(const char *path, double delta, size_t *len);
+
+/* Apply one operand (patch or increment) to doc, as a merge would. Takes
+ * ownership of doc (which may be NULL) and returns the result. */
+cJSON *arocks_merge_apply(cJSON *doc, const char *operand, size_t len);
+
+/* Apply patch to target, RFC 7396 style. Takes ownership of target (which
+ * may be NULL) and returns the patched document. */
+cJSON *json_merge_patch(cJSON *target, const cJSON *patch);
+
+#endif // ALVAREZ_ROCKS_MERGE_H_
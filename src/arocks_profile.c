@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arocks.h"
+#include "arocks_profile.h"
+#include "cJSON.h"
+#include "edn_parse.h"
+
+static const char *compression_names[] = {"none", "snappy", "zlib",  "bz2",
+                                          "lz4",  "lz4hc",  "xpress", "zstd"};
+
+/* rocksdb_*_compression for name, -1 if it isn't one */
+static int compression_type(const char *name) {
+  int n = sizeof(compression_names) / sizeof(compression_names[0]);
+  for (int i = 0; name != NULL && i < n; i++) {
+    if (strcmp(name, compression_names[i]) == 0) {
+      return i; // names are listed in rocksdb's enum order
+    }
+  }
+  return -1;
+}
+
+/* AROCKS_COMPACTION_* for name, -1 if it isn't one */
+static int compaction_style(const char *name) {
+  if (name == NULL) {
+    return -1;
+  } else if (strcmp(name, "level") == 0) {
+    return AROCKS_COMPACTION_LEVEL;
+  } else if (strcmp(name, "universal") == 0) {
+    return AROCKS_COMPACTION_UNIVERSAL;
+  } else if (strcmp(name, "fifo") == 0) {
+    return AROCKS_COMPACTION_FIFO;
+  }
+  return -1;
+}
+
+static size_t mb(const cJSON *item) {
+  return (size_t)(item->valuedouble * (1 << 20));
+}
+
+/* returns 0 if the setting was recognised */
+static int apply_setting(arocks_config_t *cfg, const cJSON *item) {
+  const char *name = item->string;
+  const char *str = cJSON_GetStringValue(item);
+  int num = item->valueint;
+  int flag = cJSON_IsTrue(item);
+
+  if (strcmp(name, "parallelism") == 0) {
+    cfg->parallelism = num;
+  } else if (strcmp(name, "max-background-jobs") == 0) {
+    cfg->max_background_jobs = num;
+  } else if (strcmp(name, "write-buffer-mb") == 0) {
+    cfg->write_buffer_size = mb(item);
+  } else if (strcmp(name, "max-write-buffers") == 0) {
+    cfg->max_write_buffer_number = num;
+  } else if (strcmp(name, "compaction") == 0) {
+    int style = compaction_style(str);
+    if (style < 0) {
+      return -1;
+    }
+    cfg->compaction_style = style;
+  } else if (strcmp(name, "fifo-max-mb") == 0) {
+    cfg->fifo_max_bytes = mb(item);
+  } else if (strcmp(name, "num-levels") == 0) {
+    cfg->num_levels = num;
+  } else if (strcmp(name, "target-file-mb") == 0) {
+    cfg->target_file_size_base = mb(item);
+  } else if (strcmp(name, "level-base-mb") == 0) {
+    cfg->max_bytes_for_level_base = mb(item);
+  } else if (strcmp(name, "l0-compaction-trigger") == 0) {
+    cfg->level0_compaction_trigger = num;
+  } else if (strcmp(name, "disable-auto-compactions") == 0) {
+    cfg->disable_auto_compactions = flag;
+  } else if (strcmp(name, "ttl-days") == 0) {
+    cfg->ttl = (uint64_t)(item->valuedouble * 86400);
+  } else if (strcmp(name, "block-size") == 0) {
+    cfg->block_size = (size_t)num;
+  } else if (strcmp(name, "compression") == 0) {
+    // a single type for every level, or a list with one per level
+    const cJSON *levels = cJSON_IsArray(item) ? item : NULL;
+    const cJSON *level;
+    cfg->compression_levels = 0;
+    if (cJSON_IsString(item)) {
+      cfg->compression[cfg->compression_levels++] = compression_type(str);
+    }
+    cJSON_ArrayForEach(level, levels) {
+      if (cfg->compression_levels < AROCKS_MAX_LEVELS) {
+        int type = compression_type(cJSON_GetStringValue(level));
+        cfg->compression[cfg->compression_levels++] = type;
+      }
+    }
+    for (int i = 0; i < cfg->compression_levels; i++) {
+      if (cfg->compression[i] < 0) {
+        cfg->compression_levels = 0;
+        return -1;
+      }
+    }
+  } else if (strcmp(name, "zstd-dict-kb") == 0) {
+    cfg->zstd_dict_bytes = num * 1024;
+  } else if (strcmp(name, "zstd-train-kb") == 0) {
+    cfg->zstd_train_bytes = num * 1024;
+  } else if (strcmp(name, "blob-files") == 0) {
+    cfg->blob_files = flag;
+  } else if (strcmp(name, "min-blob-kb") == 0) {
+    cfg->blob_files = 1;
+    cfg->min_blob_size = (uint64_t)(item->valuedouble * 1024);
+  } else if (strcmp(name, "blob-file-mb") == 0) {
+    cfg->blob_file_size = mb(item);
+  } else if (strcmp(name, "blob-compression") == 0) {
+    int type = compression_type(str);
+    if (type < 0) {
+      return -1;
+    }
+    cfg->blob_compression = type;
+  } else if (strcmp(name, "blob-gc") == 0) {
+    cfg->blob_gc = flag;
+  } else if (strcmp(name, "blob-gc-age-cutoff") == 0) {
+    cfg->blob_gc_age_cutoff = item->valuedouble;
+  } else if (strcmp(name, "bloom-bits") == 0) {
+    cfg->bloom_bits = num;
+  } else if (strcmp(name, "whole-key-filtering") == 0) {
+    cfg->whole_key_filtering = flag;
+  } else if (strcmp(name, "memtable-bloom-ratio") == 0) {
+    cfg->memtable_bloom_ratio = item->valuedouble;
+  } else if (strcmp(name, "prefix-extractor") == 0) {
+    return str == NULL ? -1 : arocks_config_prefix(cfg, str);
+  } else if (strcmp(name, "key-order") == 0) {
+    return str == NULL ? -1 : arocks_config_key_order(cfg, str);
+  } else if (strcmp(name, "cache-mb") == 0) {
+    cfg->cache_size = mb(item);
+  } else if (strcmp(name, "cache-type") == 0) {
+    return str == NULL ? -1 : arocks_config_cache_type(cfg, str);
+  } else if (strcmp(name, "cache-index-filter") == 0) {
+    cfg->cache_index_and_filter_blocks = flag;
+  } else if (strcmp(name, "pin-l0") == 0) {
+    cfg->pin_l0_filter_and_index_blocks = flag;
+  } else if (strcmp(name, "statistics") == 0) {
+    cfg->statistics = flag;
+  } else if (strcmp(name, "binary-docs") == 0) {
+    cfg->binary_docs = flag;
+  } else if (strcmp(name, "sync-writes") == 0) {
+    cfg->sync_writes = flag;
+  } else if (strcmp(name, "group-commit") == 0) {
+    cfg->group_commit = flag;
+  } else if (strcmp(name, "group-commit-kb") == 0) {
+    cfg->group_commit_bytes = (size_t)num * 1024;
+  } else if (strcmp(name, "group-commit-delay-us") == 0) {
+    cfg->group_commit_delay_us = (uint64_t)num;
+  } else if (strcmp(name, "transactions") == 0) {
+    cfg->transactions = flag;
+  } else if (strcmp(name, "txn-retries") == 0) {
+    cfg->txn_retries = num;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+int arocks_profile_apply(arocks_config_t *cfg, const cJSON *preset) {
+  int unknown = 0;
+  const cJSON *item;
+  cJSON_ArrayForEach(item, preset) {
+    if (item->string != NULL && apply_setting(cfg, item) != 0) {
+      fprintf(stderr, "Ignoring profile setting %s\n", item->string);
+      unknown++;
+    }
+  }
+  return unknown;
+}
+
+static char *read_file(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    perror("Error opening file");
+    return NULL;
+  }
+  fseek(fp, 0L, SEEK_END);
+  long sz = ftell(fp);
+  fseek(fp, 0L, SEEK_SET);
+  char *text = malloc(sz + 1);
+  size_t n = fread(text, 1, sz, fp);
+  text[n] = '\0';
+  fclose(fp);
+  return text;
+}
+
+int arocks_profile_load(arocks_config_t *cfg, const char *path,
+                        const char *preset) {
+  char *text = read_file(path);
+  if (text == NULL) {
+    return -1;
+  }
+  cJSON *profiles = edn_parse(text);
+  free(text);
+  if (profiles == NULL) {
+    fprintf(stderr, "Error parsing profile file %s\n", path);
+    return -1;
+  }
+  // presets are keywords in the file, edn_parse drops the ':'
+  if (*preset == ':') {
+    preset++;
+  }
+  const cJSON *settings = cJSON_GetObjectItemCaseSensitive(profiles, preset);
+  if (!cJSON_IsObject(settings)) {
+    fprintf(stderr, "No preset %s in %s\n", preset, path);
+    cJSON_Delete(profiles);
+    return -1;
+  }
+  arocks_profile_apply(cfg, settings);
+  cJSON_Delete(profiles);
+  return 0;
+}
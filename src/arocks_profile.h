@@ -0,0 +1,25 @@
+#ifndef ALVAREZ_ROCKS_PROFILE_H_
+#define ALVAREZ_ROCKS_PROFILE_H_
+
+#include "arocks.h"
+#include "cJSON.h"
+
+/*
+** Tuning profiles: an EDN map of named presets, each a map of settings
+** applied on top of an arocks_config_t, so a DB can be retuned without a
+** recompile. See profiles.edn for the presets and the settings they take.
+**
+**   {:point-lookup {:bloom-bits 12 :block-size 4096 :cache-mb 1024}
+**    :bulk-load {:disable-auto-compactions true :write-buffer-mb 256}}
+*/
+
+/* Apply the preset named preset from the profile file at path to cfg.
+ * Returns 0, or -1 if the file or the preset can't be read. */
+int arocks_profile_load(arocks_config_t *cfg, const char *path,
+                        const char *preset);
+
+/* Apply one preset map (already parsed) to cfg, returns the number of
+ * settings that weren't recognised. */
+int arocks_profile_apply(arocks_config_t *cfg, const cJSON *preset);
+
+#endif // ALVAREZ_ROCKS_PROFILE_H_
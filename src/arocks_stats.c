@@ -0,0 +1,248 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arocks.h"
+#include "arocks_commit.h"
+#include "arocks_stats.h"
+#include "arocks_txn.h"
+
+const char *arocks_op_names[AROCKS_OP_COUNT] = {
+    "open", "put", "get", "multiget", "seek", "next", "merge"};
+
+const char *arocks_report_tickers[] = {"rocksdb.block.cache.hit",
+                                       "rocksdb.block.cache.miss",
+                                       "rocksdb.bloom.filter.useful",
+                                       "rocksdb.bloom.filter.full.positive",
+                                       "rocksdb.bytes.read",
+                                       "rocksdb.bytes.written",
+                                       "rocksdb.number.keys.read",
+                                       "rocksdb.number.keys.written",
+                                       "rocksdb.stall.micros",
+                                       "rocksdb.wal.synced",
+                                       "rocksdb.flush.write.bytes",
+                                       "rocksdb.compact.read.bytes",
+                                       "rocksdb.compact.write.bytes",
+                                       "rocksdb.blobdb.blob.file.bytes.written",
+                                       NULL};
+
+/*
+** Histogram buckets
+*/
+
+static int bucket_of(uint64_t v) {
+  if (v < 128) {
+    return (int)v;
+  }
+  int msb = 63 - __builtin_clzll(v);
+  int shift = msb - 6; // v >> shift lands in [64, 128)
+  return (shift + 1) * 64 + (int)((v >> shift) - 64);
+}
+
+/* lowest value that lands in bucket b */
+static uint64_t bucket_floor(int b) {
+  if (b < 128) {
+    return (uint64_t)b;
+  }
+  int shift = b / 64 - 1;
+  return (uint64_t)(b % 64 + 64) << shift;
+}
+
+void arocks_hist_record(arocks_hist_t *h, uint64_t ns) {
+  __atomic_fetch_add(&h->buckets[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->sum, ns, __ATOMIC_RELAXED);
+  uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+  while (ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, 1,
+                                                  __ATOMIC_RELAXED,
+                                                  __ATOMIC_RELAXED)) {
+  }
+}
+
+uint64_t arocks_hist_percentile(const arocks_hist_t *h, double p) {
+  uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(p / 100.0 * (double)count + 0.5);
+  rank = rank == 0 ? 1 : rank;
+  uint64_t seen = 0;
+  for (int b = 0; b < AROCKS_HIST_BUCKETS; b++) {
+    seen += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+    if (seen >= rank) {
+      // report the middle of the bucket, never past the largest sample
+      uint64_t lo = bucket_floor(b);
+      uint64_t mid = b + 1 < AROCKS_HIST_BUCKETS
+                         ? lo + (bucket_floor(b + 1) - lo) / 2
+                         : lo;
+      return mid < h->max ? mid : h->max;
+    }
+  }
+  return h->max;
+}
+
+/*
+** Timing arocks calls
+*/
+
+uint64_t arocks_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t arocks_timer_start(arocks_t *s) {
+  return s->latency == NULL ? 0 : arocks_now_ns();
+}
+
+void arocks_timer_stop(arocks_t *s, int op, uint64_t start) {
+  if (s->latency != NULL) {
+    arocks_hist_record(&s->latency->ops[op], arocks_now_ns() - start);
+  }
+}
+
+/*
+** Reporting
+*/
+
+static void print_ns(FILE *out, uint64_t ns) {
+  if (ns < 10000) {
+    fprintf(out, " %8lluns", (unsigned long long)ns);
+  } else if (ns < 10000000) {
+    fprintf(out, " %8.1fus", ns / 1e3);
+  } else {
+    fprintf(out, " %8.1fms", ns / 1e6);
+  }
+}
+
+/*
+** Compaction
+*/
+
+static uint64_t property(arocks_t *s, const char *name) {
+  uint64_t value = 0;
+  rocksdb_property_int_cf(s->db, s->cf, name, &value);
+  return value;
+}
+
+void arocks_compaction_stats(arocks_t *s, arocks_compaction_stats_t *stats) {
+  stats->sst_bytes = property(s, "rocksdb.total-sst-files-size");
+  stats->blob_bytes = property(s, "rocksdb.total-blob-file-size");
+  stats->live_blob_bytes = property(s, "rocksdb.live-blob-file-size");
+  stats->user_bytes = arocks_ticker(s, "rocksdb.bytes.written");
+  stats->flush_bytes = arocks_ticker(s, "rocksdb.flush.write.bytes");
+  stats->compact_read_bytes = arocks_ticker(s, "rocksdb.compact.read.bytes");
+  stats->compact_write_bytes =
+      arocks_ticker(s, "rocksdb.compact.write.bytes");
+  stats->blob_write_bytes =
+      arocks_ticker(s, "rocksdb.blobdb.blob.file.bytes.written");
+  stats->gc_bytes = arocks_ticker(s, "rocksdb.blobdb.gc.bytes.relocated");
+  stats->compact_cpu_micros =
+      arocks_histogram_sum(s, "rocksdb.compaction.times.cpu_micros");
+}
+
+double arocks_write_amp(const arocks_compaction_stats_t *stats) {
+  if (stats->user_bytes == 0) {
+    return 0;
+  }
+  uint64_t written = stats->flush_bytes + stats->compact_write_bytes +
+                     stats->blob_write_bytes;
+  return (double)written / stats->user_bytes;
+}
+
+static void print_bytes_row(FILE *out, const char *name, uint64_t before,
+                            uint64_t after) {
+  fprintf(out, "%-22s %14llu %14llu\n", name, (unsigned long long)before,
+          (unsigned long long)after);
+}
+
+static void print_work_row(FILE *out, const char *name, uint64_t before,
+                           uint64_t after) {
+  fprintf(out, "%-22s %14llu\n", name,
+          (unsigned long long)(after > before ? after - before : 0));
+}
+
+void arocks_compaction_print(const arocks_compaction_stats_t *before,
+                             const arocks_compaction_stats_t *after,
+                             FILE *out) {
+  const arocks_compaction_stats_t *b = before;
+  const arocks_compaction_stats_t *a = after;
+  fprintf(out, "%-22s %14s %14s\n", "bytes", "before", "after");
+  print_bytes_row(out, "sst files", b->sst_bytes, a->sst_bytes);
+  print_bytes_row(out, "blob files", b->blob_bytes, a->blob_bytes);
+  print_bytes_row(out, "  live", b->live_blob_bytes, a->live_blob_bytes);
+  // the tickers start at the session's open, so only the difference is
+  // this compaction's; what the app wrote before the session isn't known
+  fprintf(out, "%-22s %14s\n", "in between", "bytes");
+  print_work_row(out, "flushed", b->flush_bytes, a->flush_bytes);
+  print_work_row(out, "compaction read", b->compact_read_bytes,
+                 a->compact_read_bytes);
+  print_work_row(out, "compaction written", b->compact_write_bytes,
+                 a->compact_write_bytes);
+  print_work_row(out, "blob files written", b->blob_write_bytes,
+                 a->blob_write_bytes);
+  print_work_row(out, "blob gc relocated", b->gc_bytes, a->gc_bytes);
+  fprintf(out, "%-22s %13.2fs\n", "compaction cpu",
+          (a->compact_cpu_micros - b->compact_cpu_micros) / 1e6);
+  uint64_t stored = b->sst_bytes + b->blob_bytes;
+  uint64_t written = (a->compact_write_bytes - b->compact_write_bytes) +
+                     (a->blob_write_bytes - b->blob_write_bytes);
+  if (stored > 0) {
+    // how many times over the compaction rewrote what was there
+    fprintf(out, "%-22s %13.2fx\n", "rewritten", (double)written / stored);
+  }
+}
+
+void arocks_stats_report(arocks_t *s, FILE *out) {
+  if (s->latency != NULL) {
+    fprintf(out, "%-9s %10s %10s %10s %10s %10s\n", "op", "count", "p50",
+            "p99", "p999", "max");
+    for (int op = 0; op < AROCKS_OP_COUNT; op++) {
+      const arocks_hist_t *h = &s->latency->ops[op];
+      if (h->count == 0) {
+        continue;
+      }
+      fprintf(out, "%-9s %10llu", arocks_op_names[op],
+              (unsigned long long)h->count);
+      print_ns(out, arocks_hist_percentile(h, 50));
+      print_ns(out, arocks_hist_percentile(h, 99));
+      print_ns(out, arocks_hist_percentile(h, 99.9));
+      print_ns(out, h->max);
+      fprintf(out, "\n");
+    }
+  }
+  for (int i = 0; arocks_report_tickers[i] != NULL; i++) {
+    fprintf(out, "%-40s %12llu\n", arocks_report_tickers[i],
+            (unsigned long long)arocks_ticker(s, arocks_report_tickers[i]));
+  }
+  arocks_compaction_stats_t compaction;
+  arocks_compaction_stats(s, &compaction);
+  fprintf(out, "%-40s %11.2fs\n", "compaction cpu",
+          compaction.compact_cpu_micros / 1e6);
+  fprintf(out, "%-40s %11.2fx\n", "write amp", arocks_write_amp(&compaction));
+  double oldest;
+  int open = arocks_snapshot_count(s, &oldest);
+  if (open > 0) {
+    fprintf(out, "%-40s %12d\n", "snapshots open", open);
+    fprintf(out, "%-40s %11.1fs\n", "oldest snapshot", oldest);
+    arocks_snapshot_report(s, AROCKS_SNAPSHOT_LONG_SEC, out);
+  }
+  if (s->txn_db != NULL) {
+    arocks_txn_stats_t txns;
+    arocks_txn_stats(s, &txns);
+    fprintf(out, "%-40s %12llu\n", "txn commits",
+            (unsigned long long)txns.commits);
+    fprintf(out, "%-40s %12llu\n", "txn conflicts",
+            (unsigned long long)txns.conflicts);
+  }
+  if (s->committer != NULL) {
+    arocks_commit_stats_t commits;
+    arocks_commit_stats(s->committer, &commits);
+    fprintf(out, "%-40s %12llu\n", "group commit writes",
+            (unsigned long long)commits.writes);
+    fprintf(out, "%-40s %12llu\n", "group commit groups",
+            (unsigned long long)commits.groups);
+  }
+}
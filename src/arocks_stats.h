@@ -0,0 +1,92 @@
+#ifndef ALVAREZ_ROCKS_STATS_H_
+#define ALVAREZ_ROCKS_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arocks.h"
+
+/*
+** Latency histograms for arocks calls, recorded when a session is opened
+** with config.statistics. Buckets are HDR style: exact below 128ns, then 64
+** linear steps per power of two, so any percentile is within ~1.5% of the
+** real value. Counters are updated atomically so sessions can be shared
+** across threads.
+*/
+
+#define AROCKS_HIST_BUCKETS (59 * 64)
+
+typedef struct arocks_hist {
+  uint64_t count;
+  uint64_t sum; // ns
+  uint64_t max; // ns
+  uint64_t buckets[AROCKS_HIST_BUCKETS];
+} arocks_hist_t;
+
+void arocks_hist_record(arocks_hist_t *h, uint64_t ns);
+/* Value at percentile p (0-100) in ns, 0 if nothing was recorded. */
+uint64_t arocks_hist_percentile(const arocks_hist_t *h, double p);
+
+/* What gets timed */
+#define AROCKS_OP_OPEN 0
+#define AROCKS_OP_PUT 1
+#define AROCKS_OP_GET 2
+#define AROCKS_OP_MULTIGET 3
+#define AROCKS_OP_SEEK 4
+#define AROCKS_OP_NEXT 5
+#define AROCKS_OP_MERGE 6
+#define AROCKS_OP_COUNT 7
+
+extern const char *arocks_op_names[AROCKS_OP_COUNT];
+
+typedef struct arocks_latency {
+  arocks_hist_t ops[AROCKS_OP_COUNT];
+} arocks_latency_t;
+
+/* Monotonic clock in ns */
+uint64_t arocks_now_ns(void);
+
+/* Start timing an op on s, 0 if the session isn't recording latency. */
+uint64_t arocks_timer_start(arocks_t *s);
+void arocks_timer_stop(arocks_t *s, int op, uint64_t start);
+
+/* RocksDB tickers printed by arocks_stats_report, NULL terminated. */
+extern const char *arocks_report_tickers[];
+
+/*
+** Where compaction's work goes, for comparing layouts (blob files or not):
+** file sizes as they stand, plus bytes moved since the session opened. The
+** byte counts and CPU time come from tickers, so they need
+** config.statistics, and cover the whole DB rather than one family.
+*/
+typedef struct arocks_compaction_stats {
+  uint64_t sst_bytes;       // the session's column family
+  uint64_t blob_bytes;      // ... its blob files
+  uint64_t live_blob_bytes; // ... the part of them still referenced
+  uint64_t user_bytes;      // written by the application
+  uint64_t flush_bytes;     // SST bytes written by flushes
+  uint64_t compact_read_bytes;
+  uint64_t compact_write_bytes;
+  uint64_t blob_write_bytes; // written to blob files, flushes and GC alike
+  uint64_t gc_bytes;         // blob bytes GC relocated
+  uint64_t compact_cpu_micros;
+} arocks_compaction_stats_t;
+
+void arocks_compaction_stats(arocks_t *s, arocks_compaction_stats_t *stats);
+
+/* Bytes written to SST and blob files per byte the application wrote, 0 if
+ * it hasn't written any. */
+double arocks_write_amp(const arocks_compaction_stats_t *stats);
+
+/* Two snapshots taken either side of some work, such as arocks_compact():
+ * file sizes side by side, then the bytes moved and CPU spent in between,
+ * and how many times over the stored bytes were rewritten. */
+void arocks_compaction_print(const arocks_compaction_stats_t *before,
+                             const arocks_compaction_stats_t *after,
+                             FILE *out);
+
+/* Print p50/p99/p999 per op plus the report tickers, compaction CPU and
+ * write amplification. */
+void arocks_stats_report(arocks_t *s, FILE *out);
+
+#endif // ALVAREZ_ROCKS_STATS_H_
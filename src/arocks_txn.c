@@ -0,0 +1,326 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arocks.h"
+#include "arocks_doc.h"
+#include "arocks_index.h"
+#include "arocks_stats.h"
+#include "arocks_txn.h"
+#include "cJSON.h"
+#include "key_codec.h"
+#include "rocksdb/c.h"
+
+struct arocks_txn_db {
+  rocksdb_optimistictransactiondb_t *db;
+  rocksdb_optimistictransaction_options_t *options;
+  arocks_txn_t *open; // newest first
+  uint64_t ids;
+  pthread_mutex_t lock;
+  arocks_txn_stats_t stats;
+};
+
+rocksdb_t *arocks_txn_open(arocks_t *s, const char *db_path, int n,
+                           const char *const *names,
+                           const rocksdb_options_t *const *options,
+                           char **err) {
+  rocksdb_optimistictransactiondb_t *db =
+      rocksdb_optimistictransactiondb_open_column_families(
+          s->options, db_path, n, names, options, s->families, err);
+  if (*err != NULL) {
+    return NULL;
+  }
+  struct arocks_txn_db *t = calloc(1, sizeof(struct arocks_txn_db));
+  t->db = db;
+  t->options = rocksdb_optimistictransaction_options_create();
+  pthread_mutex_init(&t->lock, NULL);
+  s->txn_db = t;
+  return rocksdb_optimistictransactiondb_get_base_db(db);
+}
+
+void arocks_txn_close(arocks_t *s) {
+  struct arocks_txn_db *t = s->txn_db;
+  int open = 0;
+  while (t->open != NULL) {
+    arocks_txn_rollback(t->open);
+    open++;
+  }
+  if (open > 0) {
+    fprintf(stderr, "rolled back %d transactions left open\n", open);
+  }
+  rocksdb_optimistictransactiondb_close_base_db(s->db);
+  rocksdb_optimistictransactiondb_close(t->db);
+  rocksdb_optimistictransaction_options_destroy(t->options);
+  pthread_mutex_destroy(&t->lock);
+  free(t);
+  s->txn_db = NULL;
+}
+
+/*
+** Transactions
+*/
+
+arocks_txn_t *arocks_txn_begin(arocks_t *s, const void *owner) {
+  struct arocks_txn_db *db = s->txn_db;
+  if (db == NULL) {
+    return NULL;
+  }
+  arocks_txn_t *t = malloc(sizeof(arocks_txn_t));
+  t->s = s;
+  t->txn = rocksdb_optimistictransaction_begin(db->db, s->writeoptions,
+                                               db->options, NULL);
+  t->begun_ns = arocks_now_ns();
+  t->owner = owner;
+  pthread_mutex_lock(&db->lock);
+  t->id = ++db->ids;
+  t->next = db->open;
+  db->open = t;
+  pthread_mutex_unlock(&db->lock);
+  return t;
+}
+
+static void txn_free(arocks_txn_t *t) {
+  struct arocks_txn_db *db = t->s->txn_db;
+  pthread_mutex_lock(&db->lock);
+  arocks_txn_t **p = &db->open;
+  while (*p != NULL && *p != t) {
+    p = &(*p)->next;
+  }
+  if (*p != NULL) {
+    *p = t->next;
+  }
+  pthread_mutex_unlock(&db->lock);
+  rocksdb_transaction_destroy(t->txn);
+  free(t);
+}
+
+/* The stored value at a key in its stored form, read for update. */
+static char *get_stored(arocks_txn_t *t, const char *k, size_t klen,
+                        size_t *len) {
+  char *err = NULL;
+  char *value = rocksdb_transaction_get_for_update_cf(
+      t->txn, t->s->readoptions, t->s->cf, k, klen, len, 1, &err);
+  ERR(err);
+  return value;
+}
+
+char *arocks_txn_get_for_update(arocks_txn_t *t, const char *key) {
+  key_buf_t kb;
+  key_buf_init(&kb);
+  size_t klen;
+  const char *k = arocks_key_encode(t->s, key, &kb, &klen);
+  size_t len;
+  char *value = get_stored(t, k, klen, &len);
+  key_buf_free(&kb);
+  if (value != NULL && arocks_doc_is_binary(value, len)) {
+    char *text = arocks_doc_text(value, len);
+    free(value);
+    return text;
+  }
+  return value;
+}
+
+typedef struct staging {
+  arocks_txn_t *t;
+  char *err;
+} staging;
+
+static void stage_put(void *arg, const char *k, size_t klen, const char *v,
+                      size_t vlen) {
+  staging *st = arg;
+  if (st->err == NULL) {
+    rocksdb_transaction_put_cf(st->t->txn, st->t->s->cf, k, klen, v, vlen,
+                               &st->err);
+  }
+}
+
+static void stage_delete(void *arg, const char *k, size_t klen) {
+  staging *st = arg;
+  if (st->err == NULL) {
+    rocksdb_transaction_delete_cf(st->t->txn, st->t->s->cf, k, klen,
+                                  &st->err);
+  }
+}
+
+/* Index changes are worked out against the document the transaction sees,
+ * which is read for update: if someone else changes it first, the entries
+ * to remove are stale and the commit has to fail. They're collected in a
+ * batch and replayed into the transaction, all in the session's family. */
+static void stage_index(arocks_txn_t *t, const char *key, const char *k,
+                        size_t klen, const cJSON *doc) {
+  size_t len;
+  char *old = get_stored(t, k, klen, &len);
+  cJSON *old_doc = old != NULL ? arocks_doc_load(old, len) : NULL;
+  free(old);
+  rocksdb_writebatch_t *batch = rocksdb_writebatch_create();
+  arocks_index_replace(t->s, batch, key, old_doc, doc);
+  cJSON_Delete(old_doc);
+  staging st = {t, NULL};
+  rocksdb_writebatch_iterate(batch, &st, stage_put, stage_delete);
+  rocksdb_writebatch_destroy(batch);
+  ERR(st.err);
+}
+
+/* Stage value at key, or a delete when value is NULL. doc is value parsed,
+ * or NULL if it isn't a document. */
+static void stage(arocks_txn_t *t, const char *key, const char *value,
+                  const cJSON *doc) {
+  arocks_t *s = t->s;
+  char *err = NULL;
+  key_buf_t kb;
+  key_buf_init(&kb);
+  size_t klen;
+  const char *k = arocks_key_encode(s, key, &kb, &klen);
+  if (s->nindexes > 0) {
+    stage_index(t, key, k, klen, doc);
+  }
+  if (value == NULL) {
+    rocksdb_transaction_delete_cf(t->txn, s->cf, k, klen, &err);
+  } else {
+    char *stored = NULL;
+    size_t len = strlen(value) + 1;
+    if (s->config.binary_docs && (cJSON_IsObject(doc) || cJSON_IsArray(doc))) {
+      stored = arocks_doc_store(doc, 1, &len);
+    }
+    rocksdb_transaction_put_cf(t->txn, s->cf, k, klen,
+                               stored != NULL ? stored : value, len, &err);
+    free(stored);
+  }
+  key_buf_free(&kb);
+  ERR(err);
+}
+
+void arocks_txn_put(arocks_txn_t *t, const char *key, const char *value) {
+  cJSON *doc = NULL;
+  if (t->s->nindexes > 0 || t->s->config.binary_docs) {
+    doc = arocks_doc_parse(value);
+  }
+  stage(t, key, value, doc);
+  cJSON_Delete(doc);
+}
+
+void arocks_txn_delete(arocks_txn_t *t, const char *key) {
+  stage(t, key, NULL, NULL);
+}
+
+/* Busy is a key written since it was read, TryAgain a key whose writes
+ * have left the memtables, so the check couldn't be made. Either way the
+ * transaction can be run again. */
+static int is_conflict(const char *err) {
+  return strncmp(err, "Resource busy", 13) == 0 ||
+         strncmp(err, "Operation failed. Try again.", 28) == 0;
+}
+
+int arocks_txn_commit(arocks_txn_t *t) {
+  struct arocks_txn_db *db = t->s->txn_db;
+  char *err = NULL;
+  int rc = 0;
+  rocksdb_transaction_commit(t->txn, &err);
+  if (err != NULL && is_conflict(err)) {
+    free(err);
+    err = NULL;
+    rc = AROCKS_TXN_CONFLICT;
+    __atomic_add_fetch(&db->stats.conflicts, 1, __ATOMIC_RELAXED);
+  } else {
+    __atomic_add_fetch(&db->stats.commits, 1, __ATOMIC_RELAXED);
+  }
+  ERR(err);
+  txn_free(t);
+  return rc;
+}
+
+void arocks_txn_rollback(arocks_txn_t *t) {
+  char *err = NULL;
+  rocksdb_transaction_rollback(t->txn, &err);
+  ERR(err);
+  __atomic_add_fetch(&t->s->txn_db->stats.rollbacks, 1, __ATOMIC_RELAXED);
+  txn_free(t);
+}
+
+arocks_txn_t *arocks_txn_find(arocks_t *s, uint64_t id, const void *owner) {
+  struct arocks_txn_db *db = s->txn_db;
+  if (db == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&db->lock);
+  arocks_txn_t *t = db->open;
+  while (t != NULL && (t->id != id || t->owner != owner)) {
+    t = t->next;
+  }
+  pthread_mutex_unlock(&db->lock);
+  return t;
+}
+
+int arocks_txn_rollback_owned(arocks_t *s, const void *owner) {
+  struct arocks_txn_db *db = s->txn_db;
+  if (db == NULL) {
+    return 0;
+  }
+  int n = 0;
+  for (;;) {
+    pthread_mutex_lock(&db->lock);
+    arocks_txn_t *t = db->open;
+    while (t != NULL && t->owner != owner) {
+      t = t->next;
+    }
+    pthread_mutex_unlock(&db->lock);
+    if (t == NULL) {
+      return n;
+    }
+    arocks_txn_rollback(t);
+    n++;
+  }
+}
+
+/*
+** Retries
+*/
+
+/* Sleep a random part of a window that doubles with each retry, from 128us
+ * up to 8ms, so the writers that just collided don't collide again. */
+static void backoff(int retry, unsigned *seed) {
+  unsigned window = 64u << (retry < 7 ? retry : 7);
+  usleep(rand_r(seed) % window);
+}
+
+int arocks_txn_run(arocks_t *s, arocks_txn_fn fn, void *ctx, int *attempts) {
+  unsigned seed = (unsigned)arocks_now_ns();
+  int rc = AROCKS_TXN_CONFLICT;
+  int n = 0;
+  arocks_txn_t *t;
+  while ((t = arocks_txn_begin(s, NULL)) != NULL) {
+    n++;
+    rc = fn(t, ctx);
+    if (rc != 0) {
+      arocks_txn_rollback(t);
+      break;
+    }
+    rc = arocks_txn_commit(t);
+    if (rc == 0 || n > s->config.txn_retries) {
+      break;
+    }
+    backoff(n, &seed);
+  }
+  if (attempts != NULL) {
+    *attempts = n;
+  }
+  return rc;
+}
+
+void arocks_txn_stats(arocks_t *s, arocks_txn_stats_t *stats) {
+  struct arocks_txn_db *db = s->txn_db;
+  memset(stats, 0, sizeof(arocks_txn_stats_t));
+  if (db == NULL) {
+    return;
+  }
+  stats->commits = __atomic_load_n(&db->stats.commits, __ATOMIC_RELAXED);
+  stats->conflicts = __atomic_load_n(&db->stats.conflicts, __ATOMIC_RELAXED);
+  stats->rollbacks = __atomic_load_n(&db->stats.rollbacks, __ATOMIC_RELAXED);
+  pthread_mutex_lock(&db->lock);
+  for (arocks_txn_t *t = db->open; t != NULL; t = t->next) {
+    stats->open++;
+  }
+  pthread_mutex_unlock(&db->lock);
+}
@@ -0,0 +1,97 @@
+#ifndef ALVAREZ_ROCKS_TXN_H_
+#define ALVAREZ_ROCKS_TXN_H_
+
+#include <stdint.h>
+
+#include "arocks.h"
+#include "rocksdb/c.h"
+
+/*
+** Optimistic transactions. With config.transactions the DB is opened as an
+** OptimisticTransactionDB, so a read-modify-write needs no lock server:
+**
+**   - the transaction reads what it will change with get-for-update, which
+**     notes each key and the version it saw
+**   - its puts and deletes are staged, nothing is written yet
+**   - at commit RocksDB checks that none of the noted keys has been written
+**     since; if one has, the commit fails with a conflict and writes nothing
+**
+** Writers of different keys never wait for each other, and when two touch
+** the same key the loser redoes its work instead of everyone queueing on a
+** lock. arocks_txn_run does the redoing: it runs an update, and on a
+** conflict backs off for a moment and runs it again, up to
+** config.txn_retries times.
+**
+** Index entries are staged with the document (the old document is read
+** for update too), so they commit or fail along with it. Commits use the
+** session's write options (config.sync_writes) and go straight to the DB,
+** not through the group committer. Like snapshots, open transactions
+** belong to an owner, and any left open at arocks_close are rolled back.
+*/
+
+/* arocks_txn_commit and arocks_txn_run: someone else wrote a key first */
+#define AROCKS_TXN_CONFLICT (-1)
+
+typedef struct arocks_txn {
+  arocks_t *s;
+  rocksdb_transaction_t *txn;
+  uint64_t id; // unique in the session, from 1
+  uint64_t begun_ns;
+  const void *owner;
+  struct arocks_txn *next;
+} arocks_txn_t;
+
+/* Open the DB with the families in names as an OptimisticTransactionDB,
+ * filling in s->families, and return its base DB for the session's ordinary
+ * reads and writes. Called from arocks_init. */
+rocksdb_t *arocks_txn_open(arocks_t *s, const char *db_path, int n,
+                           const char *const *names,
+                           const rocksdb_options_t *const *options,
+                           char **err);
+/* Roll back the transactions still open and close the DB, in place of
+ * rocksdb_close. */
+void arocks_txn_close(arocks_t *s);
+
+/* Begin a transaction, NULL if the session wasn't opened with
+ * config.transactions. */
+arocks_txn_t *arocks_txn_begin(arocks_t *s, const void *owner);
+/* Read key (as text, see arocks_get) and have commit fail if it's written
+ * by anyone else before then. Sees the transaction's own writes. */
+char *arocks_txn_get_for_update(arocks_txn_t *t, const char *key);
+/* Stage a write, with its index changes, for commit. */
+void arocks_txn_put(arocks_txn_t *t, const char *key, const char *value);
+void arocks_txn_delete(arocks_txn_t *t, const char *key);
+/* Write everything staged, atomically. Returns 0, or AROCKS_TXN_CONFLICT if
+ * a key read for update changed meanwhile and nothing was written. Frees t
+ * either way. */
+int arocks_txn_commit(arocks_txn_t *t);
+/* Drop everything staged and free t. */
+void arocks_txn_rollback(arocks_txn_t *t);
+
+/* The open transaction with id, NULL unless owner began it. */
+arocks_txn_t *arocks_txn_find(arocks_t *s, uint64_t id, const void *owner);
+/* Roll back every transaction owner began, returns how many there were. */
+int arocks_txn_rollback_owned(arocks_t *s, const void *owner);
+
+/* An update run inside a transaction: return 0 to commit, or a positive
+ * code to roll back. */
+typedef int (*arocks_txn_fn)(arocks_txn_t *t, void *ctx);
+
+/* Run fn in a new transaction and commit it, running it again on a
+ * conflict. Returns 0 once committed, fn's code if it rolled back, or
+ * AROCKS_TXN_CONFLICT if it was still conflicting after config.txn_retries
+ * retries (or the session has no transactions). attempts, when not NULL,
+ * is set to the number of runs. */
+int arocks_txn_run(arocks_t *s, arocks_txn_fn fn, void *ctx, int *attempts);
+
+typedef struct arocks_txn_stats {
+  uint64_t commits;
+  uint64_t conflicts; // commits that failed, each one redone or given up
+  uint64_t rollbacks;
+  int open;
+} arocks_txn_stats_t;
+
+/* Zeroes unless the session has transactions. */
+void arocks_txn_stats(arocks_t *s, arocks_txn_stats_t *stats);
+
+#endif // ALVAREZ_ROCKS_TXN_H_
@@ -851,7 +851,6 @@ success:
   return true;
 
 fail:
-  printf("fail\n");
   if (head != NULL) {
     cJSON_Delete(head);
   }
@@ -5,5 +5,12 @@
 
 /* Render a cJSON item/entity/structure to text. */
 cJSON *edn_parse(const char *value);
+/* Like edn_parse, return_parse_end is set to the first byte after the form so
+ * a file holding several forms can be read one form at a time. */
+cJSON *edn_ParseWithLengthOpts(const char *value, size_t buffer_length,
+                               const char **return_parse_end,
+                               cJSON_bool require_null_terminated);
+cJSON *edn_ParseWithOpts(const char *value, const char **return_parse_end,
+                         cJSON_bool require_null_terminated);
 
 #endif // EDN_PARSE_H_
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "json_path.h"
+
+/* Swap child for item, objects need the name carried across. */
+static void path_replace(cJSON *parent, cJSON *child, cJSON *item) {
+  if (cJSON_IsArray(parent)) {
+    cJSON_ReplaceItemViaPointer(parent, child, item);
+  } else {
+    cJSON_ReplaceItemInObjectCaseSensitive(parent, child->string, item);
+  }
+}
+
+/* Find the child named by path[0..len) in an object or array. */
+static cJSON *path_child(const cJSON *item, const char *seg, size_t len) {
+  if (cJSON_IsArray(item)) {
+    char *end = NULL;
+    long idx = strtol(seg, &end, 10);
+    if (end != seg + len || idx < 0) {
+      return NULL;
+    }
+    return cJSON_GetArrayItem(item, (int)idx);
+  }
+  if (!cJSON_IsObject(item)) {
+    return NULL;
+  }
+  cJSON *child = item->child;
+  while (child != NULL) {
+    if (child->string != NULL && strlen(child->string) == len &&
+        strncmp(child->string, seg, len) == 0) {
+      return child;
+    }
+    child = child->next;
+  }
+  return NULL;
+}
+
+cJSON *json_path_get(const cJSON *doc, const char *path) {
+  if (doc == NULL || path == NULL) {
+    return NULL;
+  }
+  if (*path == ':') {
+    path++;
+  }
+  const cJSON *item = doc;
+  while (item != NULL && *path != '\0') {
+    const char *dot = strchr(path, '.');
+    size_t len = dot == NULL ? strlen(path) : (size_t)(dot - path);
+    item = path_child(item, path, len);
+    path += dot == NULL ? len : len + 1;
+  }
+  return (cJSON *)item;
+}
+
+int json_path_set(cJSON *doc, const char *path, cJSON *item) {
+  if (path != NULL && *path == ':') {
+    path++;
+  }
+  if ((!cJSON_IsObject(doc) && !cJSON_IsArray(doc)) || path == NULL ||
+      *path == '\0') {
+    cJSON_Delete(item);
+    return -1;
+  }
+  cJSON *parent = doc;
+  for (;;) {
+    const char *dot = strchr(path, '.');
+    size_t len = dot == NULL ? strlen(path) : (size_t)(dot - path);
+    cJSON *child = path_child(parent, path, len);
+    if (child == NULL && cJSON_IsArray(parent)) {
+      cJSON_Delete(item);
+      return -1;
+    }
+    if (dot == NULL) {
+      if (child != NULL) {
+        path_replace(parent, child, item);
+      } else {
+        cJSON_AddItemToObject(parent, path, item);
+      }
+      return 0;
+    }
+    if (child == NULL) {
+      child = cJSON_CreateObject();
+      char *name = strndup(path, len);
+      cJSON_AddItemToObject(parent, name, child);
+      free(name);
+    } else if (!cJSON_IsObject(child) && !cJSON_IsArray(child)) {
+      cJSON *obj = cJSON_CreateObject();
+      path_replace(parent, child, obj);
+      child = obj;
+    }
+    parent = child;
+    path = dot + 1;
+  }
+}
+
+char *json_path_key_text(const cJSON *item) {
+  char buf[64];
+  if (cJSON_IsString(item)) {
+    return strdup(item->valuestring);
+  } else if (cJSON_IsNumber(item)) {
+    double d = item->valuedouble;
+    // integral numbers become "42" rather than "42.0"
+    if (d > -9e18 && d < 9e18 && d == (double)(long long)d) {
+      snprintf(buf, sizeof(buf), "%lld", (long long)d);
+    } else {
+      snprintf(buf, sizeof(buf), "%.17g", d);
+    }
+    return strdup(buf);
+  } else if (cJSON_IsBool(item)) {
+    return strdup(cJSON_IsTrue(item) ? "true" : "false");
+  }
+  return NULL;
+}
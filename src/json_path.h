@@ -0,0 +1,26 @@
+#ifndef JSON_PATH_H_
+#define JSON_PATH_H_
+
+#include "cJSON.h"
+
+/*
+** Dotted field paths into a cJSON document, e.g. "stats.views" or the EDN
+** flavored ":stats.views". A leading ':' is ignored, and numeric segments
+** index into arrays.
+*/
+
+/* Find the item at path, returns NULL if any segment is missing. */
+cJSON *json_path_get(const cJSON *doc, const char *path);
+
+/* Put item at path, replacing whatever is there and creating missing
+ * object fields (and turning scalars in the way into objects) on the way
+ * down. Takes ownership of item. Returns 0, or -1 if doc isn't an object or
+ * array, the path is empty or it indexes past the end of an array, in which
+ * case item is freed. */
+int json_path_set(cJSON *doc, const char *path, cJSON *item);
+
+/* Render a scalar (string, number or bool) as key text, returns a malloc'd
+ * string or NULL for anything else. */
+char *json_path_key_text(const cJSON *item);
+
+#endif // JSON_PATH_H_
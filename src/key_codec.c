@@ -0,0 +1,212 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "key_codec.h"
+
+#define TAG_NULL 0x10
+#define TAG_FALSE 0x20
+#define TAG_TRUE 0x21
+#define TAG_NUMBER 0x30
+#define TAG_STRING 0x40
+#define TAG_TUPLE 0x50
+#define TAG_END 0x00
+
+void key_buf_init(key_buf_t *b) {
+  b->data = NULL;
+  b->len = 0;
+  b->cap = 0;
+}
+
+void key_buf_free(key_buf_t *b) {
+  free(b->data);
+  key_buf_init(b);
+}
+
+void key_buf_append(key_buf_t *b, const void *data, size_t len) {
+  if (b->len + len > b->cap) {
+    b->cap = b->cap == 0 ? 64 : b->cap;
+    while (b->len + len > b->cap) {
+      b->cap *= 2;
+    }
+    b->data = realloc(b->data, b->cap);
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+static void put_byte(key_buf_t *b, unsigned char c) {
+  key_buf_append(b, &c, 1);
+}
+
+static void put_number(key_buf_t *b, double d) {
+  if (d == 0) {
+    d = 0; // -0.0 sorts with 0.0
+  }
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  // negative numbers sort in reverse, and below every positive number
+  bits = (bits >> 63) ? ~bits : bits ^ ((uint64_t)1 << 63);
+  unsigned char out[8];
+  for (int i = 7; i >= 0; i--) {
+    out[i] = (unsigned char)(bits & 0xff);
+    bits >>= 8;
+  }
+  put_byte(b, TAG_NUMBER);
+  key_buf_append(b, out, sizeof(out));
+}
+
+static void put_string(key_buf_t *b, const char *s) {
+  put_byte(b, TAG_STRING);
+  for (const char *p = s; *p != '\0'; p++) {
+    put_byte(b, (unsigned char)*p);
+  }
+  // cJSON strings can't hold a NUL, so it's free to end the string
+  put_byte(b, 0x00);
+}
+
+static int encodable(const cJSON *value) {
+  if (cJSON_IsObject(value) || cJSON_IsInvalid(value)) {
+    return 0;
+  }
+  // 1e400 parses as inf, which prints back as null
+  if (cJSON_IsNumber(value) && !isfinite(value->valuedouble)) {
+    return 0;
+  }
+  const cJSON *item;
+  cJSON_ArrayForEach(item, value) {
+    if (!encodable(item)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int key_codec_put(key_buf_t *b, const cJSON *value) {
+  if (!encodable(value)) {
+    return -1;
+  }
+  if (cJSON_IsArray(value)) {
+    put_byte(b, TAG_TUPLE);
+    const cJSON *item;
+    cJSON_ArrayForEach(item, value) {
+      key_codec_put(b, item);
+    }
+    put_byte(b, TAG_END);
+  } else if (cJSON_IsNull(value)) {
+    put_byte(b, TAG_NULL);
+  } else if (cJSON_IsFalse(value)) {
+    put_byte(b, TAG_FALSE);
+  } else if (cJSON_IsTrue(value)) {
+    put_byte(b, TAG_TRUE);
+  } else if (cJSON_IsNumber(value)) {
+    put_number(b, value->valuedouble);
+  } else if (cJSON_IsString(value)) {
+    put_string(b, value->valuestring);
+  }
+  return 0;
+}
+
+/* text as a JSON value, NULL unless all of it is one: cJSON_Parse stops at
+ * the end of a value, so "2024-01-01" would read as 2024 and "nullable" as
+ * null, and keys like those would overwrite each other. */
+static cJSON *parse_text(const char *text) {
+  return cJSON_ParseWithOpts(text, NULL, 1);
+}
+
+void key_codec_put_text(key_buf_t *b, const char *text) {
+  cJSON *value = parse_text(text);
+  if (value == NULL || key_codec_put(b, value) != 0) {
+    put_string(b, text);
+  }
+  cJSON_Delete(value);
+}
+
+size_t key_codec_len(const char *data, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  switch ((unsigned char)data[0]) {
+  case TAG_NULL:
+  case TAG_FALSE:
+  case TAG_TRUE:
+    return 1;
+  case TAG_NUMBER:
+    return len >= 9 ? 9 : 0;
+  case TAG_STRING: {
+    const char *end = memchr(data + 1, '\0', len - 1);
+    return end == NULL ? 0 : (size_t)(end - data) + 1;
+  }
+  case TAG_TUPLE: {
+    size_t n = 1;
+    while (n < len && data[n] != TAG_END) {
+      size_t item = key_codec_len(data + n, len - n);
+      if (item == 0) {
+        return 0;
+      }
+      n += item;
+    }
+    return n < len ? n + 1 : 0;
+  }
+  }
+  return 0;
+}
+
+static double get_number(const unsigned char *p) {
+  uint64_t bits = 0;
+  for (int i = 0; i < 8; i++) {
+    bits = bits << 8 | p[i];
+  }
+  bits = (bits >> 63) ? bits ^ ((uint64_t)1 << 63) : ~bits;
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+cJSON *key_codec_get(const char *data, size_t len) {
+  size_t n = key_codec_len(data, len);
+  if (n == 0) {
+    return NULL;
+  }
+  switch ((unsigned char)data[0]) {
+  case TAG_NULL:
+    return cJSON_CreateNull();
+  case TAG_FALSE:
+    return cJSON_CreateFalse();
+  case TAG_TRUE:
+    return cJSON_CreateTrue();
+  case TAG_NUMBER:
+    return cJSON_CreateNumber(get_number((const unsigned char *)data + 1));
+  case TAG_STRING:
+    // data + 1 ends at the terminating 0x00
+    return cJSON_CreateString(data + 1);
+  }
+  cJSON *tuple = cJSON_CreateArray();
+  for (size_t i = 1; i < n - 1; i += key_codec_len(data + i, n - i)) {
+    cJSON_AddItemToArray(tuple, key_codec_get(data + i, n - i));
+  }
+  return tuple;
+}
+
+char *key_codec_text(const char *data, size_t len) {
+  cJSON *value = key_codec_get(data, len);
+  if (value == NULL) {
+    return strndup(data, len);
+  }
+  char *text = NULL;
+  if (cJSON_IsString(value)) {
+    // bare, unless that would read back as some other value
+    cJSON *other = parse_text(value->valuestring);
+    if (other == NULL || !encodable(other)) {
+      text = strdup(value->valuestring);
+    }
+    cJSON_Delete(other);
+  }
+  if (text == NULL) {
+    text = cJSON_PrintUnformatted(value);
+  }
+  cJSON_Delete(value);
+  return text;
+}
@@ -0,0 +1,53 @@
+#ifndef KEY_CODEC_H_
+#define KEY_CODEC_H_
+
+#include <stddef.h>
+
+#include "cJSON.h"
+
+/*
+** Order-preserving key encoding: encoded values compare bytewise (memcmp)
+** in the same order as the values themselves, and are self-delimiting, so
+** they can be followed by more key bytes. Values of different types order
+** null < false < true < numbers < strings < tuples.
+**
+**   number  0x30 + the IEEE 754 bits, sign flipped (all bits for negative
+**           numbers), big-endian
+**   string  0x40 + the bytes, then 0x00 (which a cJSON string can't hold),
+**           so "a" sorts before "ab"
+**   tuple   0x50 + each element's encoding, then 0x00 (below every tag), so
+**           a tuple sorts before the longer tuples it starts
+**
+** Numbers are doubles, as in cJSON, so integers are exact within +/-2^53.
+*/
+
+typedef struct key_buf {
+  char *data;
+  size_t len;
+  size_t cap;
+} key_buf_t;
+
+void key_buf_init(key_buf_t *b);
+void key_buf_free(key_buf_t *b);
+void key_buf_append(key_buf_t *b, const void *data, size_t len);
+
+/* Append the encoding of a scalar, or of an array as a tuple. Returns 0, or
+ * -1 (appending nothing) for objects and arrays holding them. */
+int key_codec_put(key_buf_t *b, const cJSON *value);
+
+/* Append a key given as text: text that is a JSON scalar or array all the
+ * way through ("42", "[\"acme\", 7]") is encoded as such, anything else
+ * ("42abc", "2024-01-01", "1e400", which no double holds) as a string. */
+void key_codec_put_text(key_buf_t *b, const char *text);
+
+/* Length of the encoded value at the start of data, 0 if it's malformed. */
+size_t key_codec_len(const char *data, size_t len);
+
+/* Decode the value at the start of data, NULL if it's malformed. */
+cJSON *key_codec_get(const char *data, size_t len);
+
+/* An encoded key back as malloc'd text that key_codec_put_text reads back
+ * the same: strings bare unless they'd read as JSON, the rest as JSON. */
+char *key_codec_text(const char *data, size_t len);
+
+#endif // KEY_CODEC_H_
@@ -0,0 +1,597 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arocks.h"
+#include "arocks_backup.h"
+#include "arocks_commit.h"
+#include "arocks_doc.h"
+#include "arocks_index.h"
+#include "arocks_merge.h"
+#include "arocks_stats.h"
+#include "arocks_txn.h"
+#include "cJSON.h"
+#include "mcmd.h"
+
+static const char *skip_space(const char *text) {
+  while (*text != '\0' && (unsigned char)*text <= 32) {
+    text++;
+  }
+  return text;
+}
+
+/* Commands are documents too, so they take the same EDN or JSON. */
+cJSON *mcmd_parse_doc(const char *text) { return arocks_doc_parse(text); }
+
+static cJSON *error_response(const char *msg) {
+  cJSON *res = cJSON_CreateObject();
+  cJSON_AddStringToObject(res, "error", msg);
+  return res;
+}
+
+static cJSON *ok_response(void) {
+  cJSON *res = cJSON_CreateObject();
+  cJSON_AddTrueToObject(res, "ok");
+  return res;
+}
+
+/* string values are stored as-is, anything else as unformatted JSON */
+static char *value_text(const cJSON *value) {
+  if (cJSON_IsString(value)) {
+    return strdup(value->valuestring);
+  }
+  return cJSON_PrintUnformatted(value);
+}
+
+static cJSON *exec_get(arocks_t *s, const arocks_snapshot_t *snap,
+                       const char *key) {
+  cJSON *res = cJSON_CreateObject();
+  cJSON_AddStringToObject(res, "key", key);
+  arocks_view_t view;
+  if (!arocks_get_pinned_at(s, snap, key, &view)) {
+    cJSON_AddNullToObject(res, "value");
+  } else {
+    // stored values end in '\0', so the view can be copied as a C string
+    cJSON_AddStringToObject(res, "value", view.data);
+    arocks_release(&view);
+  }
+  return res;
+}
+
+/* Read for update in a transaction. */
+static cJSON *exec_get_txn(arocks_txn_t *t, const char *key) {
+  cJSON *res = cJSON_CreateObject();
+  cJSON_AddStringToObject(res, "key", key);
+  char *value = arocks_txn_get_for_update(t, key);
+  if (value == NULL) {
+    cJSON_AddNullToObject(res, "value");
+  } else {
+    cJSON_AddStringToObject(res, "value", value);
+    free(value);
+  }
+  return res;
+}
+
+/* A put, staged in t if there's one. */
+static cJSON *exec_put(arocks_t *s, arocks_txn_t *t, const char *key,
+                       const cJSON *value) {
+  if (value == NULL) {
+    return error_response("put requires a value");
+  }
+  char *text = value_text(value);
+  if (t != NULL) {
+    arocks_txn_put(t, key, text);
+  } else {
+    arocks_put(s, key, text);
+  }
+  free(text);
+  return ok_response();
+}
+
+typedef struct update_ctx {
+  const char *key;
+  const char *patch;
+  char *value; // the document as last written
+} update_ctx;
+
+static int update_doc(arocks_txn_t *t, void *arg) {
+  update_ctx *u = arg;
+  char *old = arocks_txn_get_for_update(t, u->key);
+  cJSON *doc = arocks_merge_apply(old != NULL ? arocks_doc_parse(old) : NULL,
+                                  u->patch, strlen(u->patch) + 1);
+  free(old);
+  free(u->value);
+  u->value = doc != NULL ? cJSON_PrintUnformatted(doc) : strdup("null");
+  cJSON_Delete(doc);
+  arocks_txn_put(t, u->key, u->value);
+  return 0;
+}
+
+/* Patch the document at key in a transaction, retried on conflict, and
+ * return the result. Unlike merge the patch is applied here, so the
+ * response has the document it produced. */
+static cJSON *exec_update(arocks_t *s, const char *key, const cJSON *patch) {
+  if (!cJSON_IsObject(patch)) {
+    return error_response("update requires a patch");
+  }
+  char *text = cJSON_PrintUnformatted(patch);
+  update_ctx u = {key, text, NULL};
+  int attempts;
+  int rc = arocks_txn_run(s, update_doc, &u, &attempts);
+  free(text);
+  if (rc != 0) {
+    free(u.value);
+    return error_response(s->txn_db == NULL ? "transactions are off"
+                                            : "conflict");
+  }
+  cJSON *res = cJSON_CreateObject();
+  cJSON_AddStringToObject(res, "key", key);
+  cJSON_AddStringToObject(res, "value", u.value);
+  cJSON_AddNumberToObject(res, "attempts", attempts);
+  free(u.value);
+  return res;
+}
+
+static cJSON *exec_merge(arocks_t *s, const char *key, const cJSON *patch) {
+  if (patch == NULL) {
+    return error_response("merge requires a patch");
+  }
+  char *text = cJSON_PrintUnformatted(patch);
+  arocks_merge(s, key, text);
+  free(text);
+  return ok_response();
+}
+
+static cJSON *exec_incr(arocks_t *s, const char *key, const cJSON *cmd) {
+  const char *path = cJSON_GetStringValue(cJSON_GetObjectItem(cmd, "path"));
+  const cJSON *by = cJSON_GetObjectItem(cmd, "by");
+  if (path == NULL || (by != NULL && !cJSON_IsNumber(by))) {
+    return error_response("incr requires a path, and by must be a number");
+  }
+  if (arocks_increment(s, key, path, by == NULL ? 1 : by->valuedouble) != 0) {
+    return error_response("incr requires a field path");
+  }
+  return ok_response();
+}
+
+static int add_entry(const char *key, size_t klen, const char *val,
+                     size_t vlen, void *ctx) {
+  cJSON *entry = cJSON_CreateObject();
+  // stored keys and values end in '\0', so the borrowed bytes are C strings
+  cJSON_AddStringToObject(entry, "key", key);
+  cJSON_AddStringToObject(entry, "value", val);
+  cJSON_AddItemToArray((cJSON *)ctx, entry);
+  return 0;
+}
+
+static int add_key(const char *key, size_t klen, const char *val,
+                   size_t vlen, void *ctx) {
+  cJSON_AddItemToArray((cJSON *)ctx, cJSON_CreateString(key));
+  return 0;
+}
+
+static void scan_opts(arocks_scan_opts_t *opts, const arocks_snapshot_t *snap,
+                      const char *key, const cJSON *cmd) {
+  memset(opts, 0, sizeof(*opts));
+  opts->start = key;
+  opts->end = cJSON_GetStringValue(cJSON_GetObjectItem(cmd, "end"));
+  opts->reverse = cJSON_IsTrue(cJSON_GetObjectItem(cmd, "reverse"));
+  opts->prefix = cJSON_IsTrue(cJSON_GetObjectItem(cmd, "prefix"));
+  opts->snapshot = snap;
+}
+
+static cJSON *exec_scan(arocks_t *s, const arocks_snapshot_t *snap,
+                        const char *key, const cJSON *cmd) {
+  const cJSON *count = cJSON_GetObjectItem(cmd, "count");
+  arocks_scan_opts_t opts;
+  scan_opts(&opts, snap, key, cmd);
+  opts.limit = cJSON_IsNumber(count) ? count->valueint : 1;
+  opts.keys_only = cJSON_IsTrue(cJSON_GetObjectItem(cmd, "keys_only"));
+  if (opts.limit <= 0) {
+    return error_response("scan count must be positive");
+  }
+  cJSON *res = cJSON_CreateObject();
+  if (opts.keys_only) {
+    cJSON *keys = cJSON_AddArrayToObject(res, "keys");
+    arocks_scan_each(s, &opts, add_key, keys);
+  } else {
+    cJSON *entries = cJSON_AddArrayToObject(res, "entries");
+    arocks_scan_each(s, &opts, add_entry, entries);
+  }
+  return res;
+}
+
+/* The keys a scan from key (all of them when it's missing) would visit, or
+ * an estimate of those up to end with approx. */
+static cJSON *exec_count(arocks_t *s, const arocks_snapshot_t *snap,
+                         const char *key, const cJSON *cmd) {
+  const cJSON *count = cJSON_GetObjectItem(cmd, "count");
+  arocks_scan_opts_t opts;
+  scan_opts(&opts, snap, key, cmd);
+  opts.limit = cJSON_IsNumber(count) ? count->valueint : 0;
+  cJSON *res = cJSON_CreateObject();
+  if (!cJSON_IsTrue(cJSON_GetObjectItem(cmd, "approx"))) {
+    cJSON_AddNumberToObject(res, "count",
+                            (double)arocks_scan_each(s, &opts, NULL, NULL));
+    return res;
+  }
+  if (snap != NULL || opts.reverse || opts.prefix || opts.limit != 0) {
+    cJSON_Delete(res);
+    return error_response("approx counts take only key and end");
+  }
+  uint64_t bytes;
+  uint64_t n = arocks_estimate_count(s, key, opts.end, &bytes);
+  cJSON_AddNumberToObject(res, "count", (double)n);
+  cJSON_AddNumberToObject(res, "bytes", (double)bytes);
+  cJSON_AddTrueToObject(res, "approx");
+  return res;
+}
+
+static cJSON *exec_mget(arocks_t *s, const arocks_snapshot_t *snap,
+                        const cJSON *keys) {
+  int n = cJSON_GetArraySize(keys);
+  if (!cJSON_IsArray(keys) || n == 0) {
+    return error_response("mget requires a list of keys");
+  }
+  const char **names = malloc(n * sizeof(char *));
+  arocks_view_t *views = malloc(n * sizeof(arocks_view_t));
+  int i = 0;
+  cJSON *k;
+  cJSON_ArrayForEach(k, keys) {
+    if (!cJSON_IsString(k)) {
+      free(names);
+      free(views);
+      return error_response("mget keys must be strings");
+    }
+    names[i++] = k->valuestring;
+  }
+  arocks_multi_get_pinned_at(s, snap, n, names, views);
+  cJSON *res = cJSON_CreateObject();
+  cJSON *values = cJSON_AddArrayToObject(res, "values");
+  for (i = 0; i < n; i++) {
+    if (views[i].data == NULL) {
+      cJSON_AddItemToArray(values, cJSON_CreateNull());
+    } else {
+      cJSON_AddItemToArray(values, cJSON_CreateString(views[i].data));
+      arocks_release(&views[i]);
+    }
+  }
+  free(names);
+  free(views);
+  return res;
+}
+
+static cJSON *exec_index(arocks_t *s, const cJSON *cmd) {
+  const char *path = cJSON_GetStringValue(cJSON_GetObjectItem(cmd, "path"));
+  if (path == NULL) {
+    return error_response("index requires a path");
+  }
+  cJSON *res = ok_response();
+  cJSON_AddNumberToObject(res, "indexed", (double)arocks_index_create(s, path));
+  return res;
+}
+
+/* {"path": p, "eq": v} or a range with "from" and/or "to", inclusive */
+static cJSON *exec_query(arocks_t *s, const cJSON *cmd) {
+  const char *path = cJSON_GetStringValue(cJSON_GetObjectItem(cmd, "path"));
+  const cJSON *eq = cJSON_GetObjectItem(cmd, "eq");
+  const cJSON *count = cJSON_GetObjectItem(cmd, "count");
+  if (path == NULL) {
+    return error_response("query requires a path");
+  }
+  const cJSON *lo = eq != NULL ? eq : cJSON_GetObjectItem(cmd, "from");
+  const cJSON *hi = eq != NULL ? eq : cJSON_GetObjectItem(cmd, "to");
+  long limit = cJSON_IsNumber(count) ? count->valueint : 0;
+  cJSON *res = cJSON_CreateObject();
+  cJSON *entries = cJSON_AddArrayToObject(res, "entries");
+  if (arocks_index_query(s, path, lo, hi, limit, add_entry, entries) < 0) {
+    cJSON_Delete(res);
+    return error_response("no index on path");
+  }
+  return res;
+}
+
+static cJSON *exec_checkpoint(arocks_t *s, const cJSON *cmd) {
+  const char *path = cJSON_GetStringValue(cJSON_GetObjectItem(cmd, "path"));
+  if (path == NULL) {
+    return error_response("checkpoint requires a path");
+  }
+  char *err = NULL;
+  uint64_t start = arocks_now_ns();
+  if (arocks_checkpoint(s, path, &err) != 0) {
+    cJSON *res = error_response(err);
+    free(err);
+    return res;
+  }
+  cJSON *res = ok_response();
+  cJSON_AddNumberToObject(res, "ms", (arocks_now_ns() - start) / 1e6);
+  return res;
+}
+
+/* {"path": dir} with optional "keep" (backups) and "mb_per_sec" */
+static cJSON *exec_backup(arocks_t *s, const cJSON *cmd) {
+  const char *path = cJSON_GetStringValue(cJSON_GetObjectItem(cmd, "path"));
+  const cJSON *keep = cJSON_GetObjectItem(cmd, "keep");
+  const cJSON *rate = cJSON_GetObjectItem(cmd, "mb_per_sec");
+  if (path == NULL) {
+    return error_response("backup requires a path");
+  }
+  arocks_backup_opts_t opts = arocks_backup_defaults();
+  opts.keep = cJSON_IsNumber(keep) ? keep->valueint : 0;
+  if (cJSON_IsNumber(rate)) {
+    opts.rate_limit = (uint64_t)(rate->valuedouble * (1 << 20));
+  }
+  arocks_backup_report_t report;
+  char *err = NULL;
+  if (arocks_backup(s, path, &opts, &report, &err) != 0) {
+    cJSON *res = error_response(err);
+    free(err);
+    return res;
+  }
+  cJSON *res = cJSON_CreateObject();
+  cJSON_AddNumberToObject(res, "backup", report.id);
+  cJSON_AddNumberToObject(res, "files", report.files);
+  cJSON_AddNumberToObject(res, "bytes", (double)report.size);
+  cJSON_AddNumberToObject(res, "copied", (double)report.copied);
+  cJSON_AddNumberToObject(res, "backups", report.backups);
+  cJSON_AddNumberToObject(res, "sec", report.seconds);
+  return res;
+}
+
+static cJSON *exec_stats(arocks_t *s) {
+  arocks_cache_stats_t stats;
+  arocks_cache_stats(s, &stats);
+  cJSON *res = cJSON_CreateObject();
+  cJSON *cache = cJSON_AddObjectToObject(res, "cache");
+  cJSON_AddNumberToObject(cache, "capacity", (double)stats.capacity);
+  cJSON_AddNumberToObject(cache, "usage", (double)stats.usage);
+  cJSON_AddNumberToObject(cache, "pinned", (double)stats.pinned);
+  // the rest needs config.statistics (-stats), 0s would only mislead
+  int statistics = s->config.statistics;
+  if (statistics) {
+    cJSON_AddNumberToObject(cache, "hits", (double)stats.hits);
+    cJSON_AddNumberToObject(cache, "misses", (double)stats.misses);
+    cJSON_AddNumberToObject(cache, "index_hits", (double)stats.index_hits);
+    cJSON_AddNumberToObject(cache, "filter_hits", (double)stats.filter_hits);
+    cJSON_AddNumberToObject(cache, "data_hits", (double)stats.data_hits);
+    uint64_t lookups = stats.hits + stats.misses;
+    cJSON_AddNumberToObject(cache, "hit_rate",
+                            lookups == 0 ? 0 : (double)stats.hits / lookups);
+  }
+
+  if (s->latency != NULL) {
+    // latencies in microseconds
+    cJSON *latency = cJSON_AddObjectToObject(res, "latency_us");
+    for (int op = 0; op < AROCKS_OP_COUNT; op++) {
+      const arocks_hist_t *h = &s->latency->ops[op];
+      cJSON *o = cJSON_AddObjectToObject(latency, arocks_op_names[op]);
+      cJSON_AddNumberToObject(o, "count", (double)h->count);
+      cJSON_AddNumberToObject(o, "p50", arocks_hist_percentile(h, 50) / 1e3);
+      cJSON_AddNumberToObject(o, "p99", arocks_hist_percentile(h, 99) / 1e3);
+      cJSON_AddNumberToObject(o, "p999",
+                              arocks_hist_percentile(h, 99.9) / 1e3);
+      cJSON_AddNumberToObject(o, "max", h->max / 1e3);
+    }
+  }
+  if (statistics) {
+    cJSON *tickers = cJSON_AddObjectToObject(res, "tickers");
+    for (int i = 0; arocks_report_tickers[i] != NULL; i++) {
+      cJSON_AddNumberToObject(
+          tickers, arocks_report_tickers[i],
+          (double)arocks_ticker(s, arocks_report_tickers[i]));
+    }
+  }
+  arocks_compaction_stats_t compaction;
+  arocks_compaction_stats(s, &compaction);
+  cJSON *c = cJSON_AddObjectToObject(res, "compaction");
+  cJSON_AddNumberToObject(c, "sst_bytes", (double)compaction.sst_bytes);
+  cJSON_AddNumberToObject(c, "blob_bytes", (double)compaction.blob_bytes);
+  if (statistics) {
+    cJSON_AddNumberToObject(c, "cpu_sec",
+                            compaction.compact_cpu_micros / 1e6);
+    cJSON_AddNumberToObject(c, "write_amp", arocks_write_amp(&compaction));
+  }
+  double oldest;
+  int open = arocks_snapshot_count(s, &oldest);
+  cJSON *snapshots = cJSON_AddObjectToObject(res, "snapshots");
+  cJSON_AddNumberToObject(snapshots, "open", open);
+  cJSON_AddNumberToObject(snapshots, "oldest_sec", oldest);
+  if (s->txn_db != NULL) {
+    arocks_txn_stats_t txns;
+    arocks_txn_stats(s, &txns);
+    cJSON *t = cJSON_AddObjectToObject(res, "transactions");
+    cJSON_AddNumberToObject(t, "commits", (double)txns.commits);
+    cJSON_AddNumberToObject(t, "conflicts", (double)txns.conflicts);
+    cJSON_AddNumberToObject(t, "rollbacks", (double)txns.rollbacks);
+    cJSON_AddNumberToObject(t, "open", txns.open);
+  }
+  if (s->committer != NULL) {
+    arocks_commit_stats_t commits;
+    arocks_commit_stats(s->committer, &commits);
+    cJSON *g = cJSON_AddObjectToObject(res, "group_commit");
+    cJSON_AddNumberToObject(g, "writes", (double)commits.writes);
+    cJSON_AddNumberToObject(g, "groups", (double)commits.groups);
+    cJSON_AddNumberToObject(g, "bytes", (double)commits.bytes);
+  }
+  return res;
+}
+
+/* The snapshot cmd names in snap, NULL if it names none. Returns -1 if it
+ * names one owner doesn't hold. */
+static int command_snapshot(arocks_t *s, const cJSON *cmd, const void *owner,
+                            arocks_snapshot_t **snap) {
+  const cJSON *id = cJSON_GetObjectItem(cmd, "snapshot");
+  *snap = NULL;
+  if (id == NULL) {
+    return 0;
+  }
+  if (cJSON_IsNumber(id) && id->valuedouble > 0) {
+    *snap = arocks_snapshot_find(s, (uint64_t)id->valuedouble, owner);
+  }
+  return *snap != NULL ? 0 : -1;
+}
+
+/* The same for the transaction cmd names. */
+static int command_txn(arocks_t *s, const cJSON *cmd, const void *owner,
+                       arocks_txn_t **t) {
+  const cJSON *id = cJSON_GetObjectItem(cmd, "txn");
+  *t = NULL;
+  if (id == NULL) {
+    return 0;
+  }
+  if (cJSON_IsNumber(id) && id->valuedouble > 0) {
+    *t = arocks_txn_find(s, (uint64_t)id->valuedouble, owner);
+  }
+  return *t != NULL ? 0 : -1;
+}
+
+/* begin, commit and rollback, and the ops that can be part of a
+ * transaction: get (for update), put and delete. */
+static cJSON *exec_txn(arocks_t *s, arocks_txn_t *t, const char *op,
+                       const char *key, const cJSON *cmd, const void *owner) {
+  if (strcmp(op, "begin") == 0) {
+    t = arocks_txn_begin(s, owner);
+    if (t == NULL) {
+      return error_response("transactions are off");
+    }
+    cJSON *res = cJSON_CreateObject();
+    cJSON_AddNumberToObject(res, "txn", (double)t->id);
+    return res;
+  }
+  if (t == NULL) {
+    return error_response("commit and rollback require a txn");
+  }
+  if (strcmp(op, "commit") == 0) {
+    if (arocks_txn_commit(t) != 0) {
+      return error_response("conflict");
+    }
+    return ok_response();
+  }
+  if (strcmp(op, "rollback") == 0) {
+    arocks_txn_rollback(t);
+    return ok_response();
+  }
+  if (key == NULL) {
+    return error_response("missing key");
+  }
+  if (strcmp(op, "get") == 0) {
+    return exec_get_txn(t, key);
+  } else if (strcmp(op, "put") == 0) {
+    return exec_put(s, t, key, cJSON_GetObjectItem(cmd, "value"));
+  } else if (strcmp(op, "delete") == 0) {
+    arocks_txn_delete(t, key);
+    return ok_response();
+  }
+  return error_response("op can't be part of a transaction");
+}
+
+cJSON *mcmd_exec(arocks_t *s, const cJSON *cmd) {
+  return mcmd_exec_owned(s, cmd, NULL);
+}
+
+cJSON *mcmd_exec_owned(arocks_t *s, const cJSON *cmd, const void *owner) {
+  if (!cJSON_IsObject(cmd)) {
+    return error_response("command must be an object");
+  }
+  const char *op = cJSON_GetStringValue(cJSON_GetObjectItem(cmd, "op"));
+  const char *key = cJSON_GetStringValue(cJSON_GetObjectItem(cmd, "key"));
+  if (op == NULL) {
+    return error_response("missing op");
+  }
+  arocks_snapshot_t *snap;
+  if (command_snapshot(s, cmd, owner, &snap) != 0) {
+    return error_response("unknown snapshot");
+  }
+  arocks_txn_t *t;
+  if (command_txn(s, cmd, owner, &t) != 0) {
+    return error_response("unknown txn");
+  }
+  if (t != NULL || strcmp(op, "begin") == 0 || strcmp(op, "commit") == 0 ||
+      strcmp(op, "rollback") == 0) {
+    return exec_txn(s, t, op, key, cmd, owner);
+  }
+  if (strcmp(op, "stats") == 0) {
+    return exec_stats(s);
+  }
+  if (strcmp(op, "snapshot") == 0) {
+    cJSON *res = cJSON_CreateObject();
+    cJSON_AddNumberToObject(res, "snapshot",
+                            (double)arocks_snapshot(s, owner)->id);
+    return res;
+  }
+  if (strcmp(op, "release") == 0) {
+    if (snap == NULL) {
+      return error_response("release requires a snapshot");
+    }
+    arocks_snapshot_release(s, snap);
+    return ok_response();
+  }
+  if (strcmp(op, "mget") == 0) {
+    return exec_mget(s, snap, cJSON_GetObjectItem(cmd, "keys"));
+  }
+  if (strcmp(op, "index") == 0) {
+    return exec_index(s, cmd);
+  }
+  if (strcmp(op, "checkpoint") == 0) {
+    return exec_checkpoint(s, cmd);
+  }
+  if (strcmp(op, "backup") == 0) {
+    return exec_backup(s, cmd);
+  }
+  if (strcmp(op, "query") == 0) {
+    return exec_query(s, cmd);
+  }
+  if (strcmp(op, "count") == 0) {
+    return exec_count(s, snap, key, cmd);
+  }
+  if (key == NULL) {
+    return error_response("missing key");
+  }
+
+  if (strcmp(op, "get") == 0) {
+    return exec_get(s, snap, key);
+  } else if (strcmp(op, "put") == 0) {
+    return exec_put(s, NULL, key, cJSON_GetObjectItem(cmd, "value"));
+  } else if (strcmp(op, "delete") == 0) {
+    arocks_delete(s, key);
+    return ok_response();
+  } else if (strcmp(op, "merge") == 0) {
+    return exec_merge(s, key, cJSON_GetObjectItem(cmd, "patch"));
+  } else if (strcmp(op, "incr") == 0) {
+    return exec_incr(s, key, cmd);
+  } else if (strcmp(op, "update") == 0) {
+    return exec_update(s, key, cJSON_GetObjectItem(cmd, "patch"));
+  } else if (strcmp(op, "scan") == 0) {
+    return exec_scan(s, snap, key, cmd);
+  }
+  return error_response("unknown op");
+}
+
+char *mcmd_exec_line(arocks_t *s, const char *line) {
+  cJSON *cmd = mcmd_parse_doc(line);
+  cJSON *res = cmd == NULL ? error_response("could not parse command")
+                           : mcmd_exec(s, cmd);
+  char *out = cJSON_PrintUnformatted(res);
+  cJSON_Delete(cmd);
+  cJSON_Delete(res);
+  return out;
+}
+
+long mcmd_run_stream(arocks_t *s, FILE *in, FILE *out) {
+  char *line = NULL;
+  size_t cap = 0;
+  long n = 0;
+  while (getline(&line, &cap, in) != -1) {
+    if (*skip_space(line) == '\0') {
+      continue; // blank line
+    }
+    char *res = mcmd_exec_line(s, line);
+    fprintf(out, "%s\n", res);
+    // the other end of the pipe is usually waiting on this response
+    fflush(out);
+    free(res);
+    n++;
+  }
+  free(line);
+  return n;
+}
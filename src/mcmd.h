@@ -0,0 +1,74 @@
+#ifndef MCMD_H_
+#define MCMD_H_
+
+#include <stdio.h>
+
+#include "arocks.h"
+#include "cJSON.h"
+
+/*
+** Modric commands: get/mget/put/merge/incr/scan/delete/index/query requests
+** encoded as one JSON or EDN object per line, executed against an open
+** arocks session.
+**
+**   {"op": "put", "key": "Brian", "value": {"skill-level": -1}}
+**   {:op "get" :key "Brian"}
+**   {"op": "mget", "keys": ["Brian", "Luka"]}
+**   {:op "merge" :key "Brian" :patch {:skill-level 0}}
+**   {:op "incr" :key "Brian" :path "stats.views" :by 1}
+**   {:op "scan" :key "B" :count 10}
+**   {:op "scan" :key "B" :count 10 :keys_only true} -> {"keys": [...]}
+**   {:op "count" :key "B" :end "C"}             -> {"count": 2}
+**   {:op "count" :approx true}                  -> {"count": ..., "bytes": ...}
+**   {"op": "delete", "key": "Brian"}
+**   {:op "index" :path "color"}
+**   {"op": "query", "path": "color", "eq": "red"}
+**   {:op "query" :path "price" :from 10 :to 20 :count 5}
+**
+** count walks the keys without copying a value, approx estimates them
+** from SST sizes without reading any (see arocks_estimate_count).
+**
+** get, mget, scan and count read as of a snapshot when given its id, so several
+** reads see the DB at one moment. Release snapshots when done with them,
+** the session releases any left at close.
+**
+**   {"op": "snapshot"}                          -> {"snapshot": 1}
+**   {:op "mget" :keys ["Brian" "Luka"] :snapshot 1}
+**   {"op": "release", "snapshot": 1}
+**
+** With transactions on (-txn, see arocks_txn.h) a read-modify-write can run
+** without a lock: get in a transaction reads for update, put and delete are
+** staged, and commit fails with "conflict" (writing nothing) if another
+** writer changed a key read meanwhile, in which case start over. update
+** does all of that with a patch, retrying conflicts itself.
+**
+**   {"op": "begin"}                             -> {"txn": 1}
+**   {:op "get" :key "Brian" :txn 1}
+**   {:op "put" :key "Brian" :value {:skill-level 1} :txn 1}
+**   {"op": "commit", "txn": 1}                  -> {"ok": true}
+**   {:op "update" :key "Brian" :patch {:skill-level 2}}
+**
+** checkpoint and backup copy the open DB (see arocks_backup.h), so a
+** running server can be backed up without stopping it.
+**
+**   {"op": "checkpoint", "path": "/backups/tonight"}
+**   {:op "backup" :path "/backups/modric" :keep 7 :mb_per_sec 50}
+*/
+
+/* Parse a document that is either EDN or JSON (sniffed from the text). */
+cJSON *mcmd_parse_doc(const char *text);
+
+/* Run one command against an open session, returns a response object. */
+cJSON *mcmd_exec(arocks_t *s, const cJSON *cmd);
+/* Same, for one of several clients sharing the session: snapshots taken
+ * belong to owner, and only its own snapshots can be named. */
+cJSON *mcmd_exec_owned(arocks_t *s, const cJSON *cmd, const void *owner);
+
+/* Run one encoded command, returns the unformatted JSON response. */
+char *mcmd_exec_line(arocks_t *s, const char *line);
+
+/* Read commands from in (one per line), write one response per line to out.
+ * Returns the number of commands run. */
+long mcmd_run_stream(arocks_t *s, FILE *in, FILE *out);
+
+#endif // MCMD_H_
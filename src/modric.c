@@ -1,11 +1,20 @@
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "arocks.h"
+#include "arocks_backup.h"
+#include "arocks_dict.h"
+#include "arocks_index.h"
+#include "arocks_load.h"
+#include "arocks_profile.h"
+#include "arocks_stats.h"
 #include "cJSON.h"
 #include "edn_parse.h"
 #include "json_pprint.h"
+#include "mcmd.h"
 #include "modriclib.h"
+#include "mserve.h"
 
 void edn_to_json_pretty_print(const char *edn_file) {
   char *res = m_read_text_file(edn_file);
@@ -57,6 +66,94 @@ void json_demo(void) {
   edn_to_json_pretty_print("colors.edn");
 }
 
+static int print_entry(const char *key, size_t klen, const char *val,
+                       size_t vlen, void *ctx) {
+  fwrite(key, 1, klen, stdout);
+  fputs(" = ", stdout);
+  fwrite(val, 1, vlen, stdout);
+  fputc('\n', stdout);
+  return 0;
+}
+
+static int print_key(const char *key, size_t klen, const char *val,
+                     size_t vlen, void *ctx) {
+  fwrite(key, 1, klen, stdout);
+  fputc('\n', stdout);
+  return 0;
+}
+
+/* Query bounds on the command line are JSON (10, true, "10") or else plain
+ * strings (red). */
+static cJSON *parse_bound(const char *arg) {
+  if (arg == NULL) {
+    return NULL;
+  }
+  cJSON *value = cJSON_Parse(arg);
+  return value != NULL ? value : cJSON_CreateString(arg);
+}
+
+/*
+** Read one key per line from path ("-" for stdin), returns a malloc'd array
+** of malloc'd keys and sets n.
+*/
+static char **read_keys(const char *path, size_t *n) {
+  FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (!fp) {
+    perror("Error opening file");
+    return NULL;
+  }
+  char **keys = NULL;
+  size_t cap = 0;
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+  *n = 0;
+  while ((len = getline(&line, &line_cap, fp)) != -1) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if (*n == cap) {
+      cap = cap == 0 ? 64 : cap * 2;
+      keys = realloc(keys, cap * sizeof(char *));
+    }
+    keys[(*n)++] = strdup(line);
+  }
+  free(line);
+  if (fp != stdin) {
+    fclose(fp);
+  }
+  return keys;
+}
+
+static void multi_get_print(arocks_t *s, const char *keys_path) {
+  size_t n;
+  char **keys = read_keys(keys_path, &n);
+  if (keys == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  arocks_view_t *views = malloc(n * sizeof(arocks_view_t));
+  arocks_multi_get_pinned(s, n, (const char *const *)keys, views);
+  for (size_t i = 0; i < n; i++) {
+    if (views[i].data == NULL) {
+      printf("%s not found\n", keys[i]);
+    } else {
+      // print straight out of the pinned block, no copy
+      printf("%s = %.*s\n", keys[i], (int)views[i].len, views[i].data);
+      arocks_release(&views[i]);
+    }
+    free(keys[i]);
+  }
+  free(keys);
+  free(views);
+}
+
+static void close_db(arocks_t *s, int stats) {
+  if (stats) {
+    arocks_stats_report(s, stderr);
+  }
+  arocks_close(s);
+}
+
 static void usage(const char *prog) {
   fprintf(stderr,
           "Modric "
@@ -65,9 +162,74 @@ static void usage(const char *prog) {
           "  -e2j file.edn  - convert edn to json and pprint it\n"
           "  -ppj file.json - pprint json\n"
           "  -db path-to-db - do something against rocks db at path\n"
+          "  -cf name       - namespace (column family) to work in, tuning\n"
+          "                   flags apply to it alone (default)\n"
           "  -key           - key for rocks db operation (set, get, list)\n"
           "  -value         - value to set at key\n"
-          "  -count         - num values to return, starting at key\n",
+          "  -merge patch   - merge a JSON or EDN patch into the document\n"
+          "                   at key\n"
+          "  -incr path     - add to the number at a field path, e.g.\n"
+          "                   :stats.views\n"
+          "  -by n          - amount for -incr (1)\n"
+          "  -count         - num values to return, starting at key\n"
+          "  -end           - scan up to (not including) this key\n"
+          "  -reverse       - scan backwards from key\n"
+          "  -prefix        - scan only keys sharing key's prefix\n"
+          "  -keys-only     - scan keys alone, never copying values\n"
+          "  -count-only    - count the keys a scan would visit\n"
+          "  -approx        - estimate the keys from key to -end from SST\n"
+          "                   sizes, reading none (\"\" key for all)\n"
+          "  -profile name  - apply a tuning preset, e.g. point-lookup,\n"
+          "                   write-heavy, scan-heavy or bulk-load\n"
+          "  -profile-file f - EDN file holding the presets (profiles.edn)\n"
+          "  -prefix-extractor spec - fixed:N, capped:N or delim:C:N\n"
+          "  -key-order o   - bytes, natural (a9 < a10) or typed (keys read\n"
+          "                   as JSON: 9 < 10, [\"acme\",7]), same every open\n"
+          "  -zstd-dict-kb n - zstd with a dictionary per SST file, n KB\n"
+          "  -train-dict    - sample stored values, report what a zstd\n"
+          "                   dictionary saves and compact with one\n"
+          "  -blob-kb n     - keep values of n KB or more in blob files\n"
+          "  -blob-gc       - relocate live blobs out of old blob files\n"
+          "  -compact       - compact everything, reporting sizes before and\n"
+          "                   after and the bytes and CPU it took\n"
+          "  -bloom-bits n  - bloom filter bits per key, 0 for none (10)\n"
+          "  -cache-mb n    - block cache size in MB (64)\n"
+          "  -cache-type t  - block cache type, lru or hyper-clock (lru)\n"
+          "  -cache-index-filter - keep index and filter blocks in the cache\n"
+          "  -pin-l0        - pin L0 index and filter blocks in the cache\n"
+          "  -binary-docs   - store JSON/EDN documents binary encoded\n"
+          "  -sync          - sync the WAL before each write returns\n"
+          "  -group-commit  - share WAL syncs among concurrent writes\n"
+          "  -group-commit-delay-us n - wait up to n us for a group to fill\n"
+          "  -txn           - open for optimistic transactions (-batch and\n"
+          "                   -serve take begin/commit/rollback and update)\n"
+          "  -txn-retries n - times update reruns on a conflict (10)\n"
+          "  -stats         - print RocksDB tickers and operation latency\n"
+          "                   percentiles to stderr on exit, and behind the\n"
+          "                   stats op of -batch and -serve\n"
+          "  -keys file     - get every key listed in file (- for stdin)\n"
+          "  -batch         - read get/put/scan/delete commands (JSON or EDN,\n"
+          "                   one per line) from stdin, keeping the db open\n"
+          "  -serve sock    - serve -batch commands on a Unix socket until\n"
+          "                   SIGINT or SIGTERM\n"
+          "  -workers n     - threads running commands for -serve (1/CPU)\n"
+          "  -connect sock  - send commands from stdin to a -serve server\n"
+          "  -checkpoint dir - hard-link a consistent copy of the db into dir\n"
+          "  -backup dir    - add an incremental backup of the db to dir\n"
+          "  -backup-keep n - purge all but the newest n backups\n"
+          "  -backup-mb-s n - copy at most n MB/s while backing up\n"
+          "  -backups dir   - list the backups in dir\n"
+          "  -restore dir   - restore the latest backup in dir to -db\n"
+          "  -import file   - bulk load a JSON Lines or EDN file of documents\n"
+          "  -key-field f   - document field holding the import key (id)\n"
+          "  -format fmt    - import format, jsonl or edn (from extension)\n"
+          "  -batch-size n  - documents per write batch on import (1000)\n"
+          "  -no-wal        - skip the write-ahead log while importing\n"
+          "  -sst           - import by building and ingesting SST files\n"
+          "  -sst-dir dir   - scratch directory for -sst (sst-load)\n"
+          "  -index path    - index documents on a field, e.g. :color\n"
+          "  -query path    - documents by an indexed field, with -eq v or\n"
+          "                   -from v and/or -to v (inclusive), up to -count\n",
           prog);
   exit(EXIT_FAILURE);
 }
@@ -82,13 +244,60 @@ static void usage(const char *prog) {
 **  ./bin/modric -db path-to-db -key string-key-for-json -json path-to-json-file
 **    # print doc
 **  ./bin/modric -db path-to-db -key string-key-for-json
+**    # print docs for many keys with one MultiGet
+**  ./bin/modric -db path-to-db -keys keys.txt
+**    # stream commands through one open db
+**  ./bin/modric -db path-to-db -batch < commands.jsonl
+**    # or keep one serving them, and send them from anywhere on the box
+**  ./bin/modric -db path-to-db -serve /tmp/modric.sock
+**  ./bin/modric -connect /tmp/modric.sock < commands.jsonl
+**    # bulk load documents keyed by one of their fields
+**  ./bin/modric -db path-to-db -import docs.jsonl -key-field id
+**    # initial load of a large dataset, straight into SST files
+**  ./bin/modric -db path-to-db -import docs.jsonl -key-field id -sst
 * */
 int main(int argc, char *argv[]) {
 
   char *db_path = ".data";
   char *db_key = NULL;
   char *db_value = NULL;
+  char *db_patch = NULL;
+  char *incr_path = NULL;
+  double incr_by = 1;
+  char *keys_path = NULL;
   int db_count = 0;
+  char *index_path = NULL;
+  int train_dict = 0;
+  int compact = 0;
+  char *query_path = NULL;
+  char *query_eq = NULL;
+  char *query_from = NULL;
+  char *query_to = NULL;
+  char *db_end = NULL;
+  int reverse = 0;
+  int prefix = 0;
+  int keys_only = 0;
+  int count_only = 0;
+  int approx = 0;
+  arocks_config_t cfg = arocks_config_defaults();
+  char *profile_path = "profiles.edn";
+  int batch = 0;
+  char *serve_path = NULL;
+  int workers = 0;
+  char *connect_path = NULL;
+  int stats = 0;
+  char *import_path = NULL;
+  char *import_format = NULL;
+  char *key_field = "id";
+  long batch_size = 0;
+  int no_wal = 0;
+  int sst = 0;
+  char *sst_dir = NULL;
+  char *checkpoint_path = NULL;
+  char *backup_path = NULL;
+  char *backups_path = NULL;
+  char *restore_path = NULL;
+  arocks_backup_opts_t backup_opts = arocks_backup_defaults();
   int i;
 
   // Parse command-line flags
@@ -107,45 +316,331 @@ int main(int argc, char *argv[]) {
       break;
     } else if (strcmp(argv[i], "-db") == 0) {
       db_path = argv[++i];
+    } else if (strcmp(argv[i], "-cf") == 0) {
+      cfg.column_family = argv[++i];
     } else if (strcmp(argv[i], "-key") == 0) {
       db_key = argv[++i];
     } else if (strcmp(argv[i], "-value") == 0) {
       db_value = argv[++i];
+    } else if (strcmp(argv[i], "-merge") == 0) {
+      db_patch = argv[++i];
+    } else if (strcmp(argv[i], "-incr") == 0) {
+      incr_path = argv[++i];
+    } else if (strcmp(argv[i], "-by") == 0) {
+      incr_by = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-keys") == 0) {
+      keys_path = argv[++i];
     } else if (strcmp(argv[i], "-count") == 0) {
       db_count = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-end") == 0) {
+      db_end = argv[++i];
+    } else if (strcmp(argv[i], "-reverse") == 0) {
+      reverse = 1;
+    } else if (strcmp(argv[i], "-prefix") == 0) {
+      prefix = 1;
+    } else if (strcmp(argv[i], "-keys-only") == 0) {
+      keys_only = 1;
+    } else if (strcmp(argv[i], "-count-only") == 0) {
+      count_only = 1;
+    } else if (strcmp(argv[i], "-approx") == 0) {
+      approx = 1;
+    } else if (strcmp(argv[i], "-profile-file") == 0) {
+      profile_path = argv[++i];
+    } else if (strcmp(argv[i], "-profile") == 0) {
+      // applied here, so flags after -profile override the preset
+      if (arocks_profile_load(&cfg, profile_path, argv[++i]) != 0) {
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(argv[i], "-prefix-extractor") == 0) {
+      if (arocks_config_prefix(&cfg, argv[++i]) != 0) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "-key-order") == 0) {
+      if (arocks_config_key_order(&cfg, argv[++i]) != 0) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "-zstd-dict-kb") == 0) {
+      cfg.zstd_dict_bytes = atoi(argv[++i]) * 1024;
+    } else if (strcmp(argv[i], "-train-dict") == 0) {
+      train_dict = 1;
+    } else if (strcmp(argv[i], "-blob-kb") == 0) {
+      cfg.blob_files = 1;
+      cfg.min_blob_size = (uint64_t)atol(argv[++i]) << 10;
+    } else if (strcmp(argv[i], "-blob-gc") == 0) {
+      cfg.blob_gc = 1;
+    } else if (strcmp(argv[i], "-compact") == 0) {
+      compact = 1;
+    } else if (strcmp(argv[i], "-bloom-bits") == 0) {
+      cfg.bloom_bits = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-cache-mb") == 0) {
+      cfg.cache_size = (size_t)atol(argv[++i]) << 20;
+    } else if (strcmp(argv[i], "-cache-type") == 0) {
+      if (arocks_config_cache_type(&cfg, argv[++i]) != 0) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "-cache-index-filter") == 0) {
+      cfg.cache_index_and_filter_blocks = 1;
+    } else if (strcmp(argv[i], "-pin-l0") == 0) {
+      cfg.pin_l0_filter_and_index_blocks = 1;
+    } else if (strcmp(argv[i], "-binary-docs") == 0) {
+      cfg.binary_docs = 1;
+    } else if (strcmp(argv[i], "-sync") == 0) {
+      cfg.sync_writes = 1;
+    } else if (strcmp(argv[i], "-group-commit") == 0) {
+      cfg.group_commit = 1;
+    } else if (strcmp(argv[i], "-group-commit-delay-us") == 0) {
+      cfg.group_commit = 1;
+      cfg.group_commit_delay_us = (uint64_t)atol(argv[++i]);
+    } else if (strcmp(argv[i], "-txn") == 0) {
+      cfg.transactions = 1;
+    } else if (strcmp(argv[i], "-txn-retries") == 0) {
+      cfg.transactions = 1;
+      cfg.txn_retries = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-stats") == 0) {
+      stats = 1;
+    } else if (strcmp(argv[i], "-batch") == 0) {
+      batch = 1;
+    } else if (strcmp(argv[i], "-serve") == 0) {
+      serve_path = argv[++i];
+    } else if (strcmp(argv[i], "-workers") == 0) {
+      workers = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-connect") == 0) {
+      connect_path = argv[++i];
+    } else if (strcmp(argv[i], "-checkpoint") == 0) {
+      checkpoint_path = argv[++i];
+    } else if (strcmp(argv[i], "-backup") == 0) {
+      backup_path = argv[++i];
+    } else if (strcmp(argv[i], "-backup-keep") == 0) {
+      backup_opts.keep = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-backup-mb-s") == 0) {
+      backup_opts.rate_limit = (uint64_t)atol(argv[++i]) << 20;
+    } else if (strcmp(argv[i], "-backups") == 0) {
+      backups_path = argv[++i];
+    } else if (strcmp(argv[i], "-restore") == 0) {
+      restore_path = argv[++i];
+    } else if (strcmp(argv[i], "-import") == 0) {
+      import_path = argv[++i];
+    } else if (strcmp(argv[i], "-key-field") == 0) {
+      key_field = argv[++i];
+    } else if (strcmp(argv[i], "-format") == 0) {
+      import_format = argv[++i];
+    } else if (strcmp(argv[i], "-batch-size") == 0) {
+      batch_size = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-no-wal") == 0) {
+      no_wal = 1;
+    } else if (strcmp(argv[i], "-sst") == 0) {
+      sst = 1;
+    } else if (strcmp(argv[i], "-sst-dir") == 0) {
+      sst_dir = argv[++i];
+    } else if (strcmp(argv[i], "-index") == 0) {
+      index_path = argv[++i];
+    } else if (strcmp(argv[i], "-query") == 0) {
+      query_path = argv[++i];
+    } else if (strcmp(argv[i], "-eq") == 0) {
+      query_eq = argv[++i];
+    } else if (strcmp(argv[i], "-from") == 0) {
+      query_from = argv[++i];
+    } else if (strcmp(argv[i], "-to") == 0) {
+      query_to = argv[++i];
     } else {
       usage(argv[0]);
       break;
     }
   }
 
-  if (db_path != NULL) {
+  if (stats) {
+    cfg.statistics = 1;
+  }
+  if (connect_path != NULL) {
+    int fd = mserve_connect(connect_path);
+    if (fd < 0 || mserve_client_stream(fd, stdin, stdout) < 0) {
+      fprintf(stderr, "server closed the connection early\n");
+      return EXIT_FAILURE;
+    }
+    close(fd);
+  } else if (backups_path != NULL) {
+    char *err = NULL;
+    if (arocks_backup_list(backups_path, stdout, &err) != 0) {
+      fprintf(stderr, "can't read backups in %s: %s\n", backups_path, err);
+      free(err);
+      return EXIT_FAILURE;
+    }
+  } else if (db_path != NULL && restore_path != NULL) {
+    char *err = NULL;
+    if (arocks_backup_restore(restore_path, db_path, &err) != 0) {
+      fprintf(stderr, "restore failed: %s\n", err);
+      free(err);
+      return EXIT_FAILURE;
+    }
+    printf("restored the latest backup in %s to %s\n", restore_path, db_path);
+  } else if (db_path != NULL && checkpoint_path != NULL) {
+    arocks_t *s = arocks_open_with(db_path, &cfg);
+    char *err = NULL;
+    uint64_t start = arocks_now_ns();
+    int rc = arocks_checkpoint(s, checkpoint_path, &err);
+    double ms = (arocks_now_ns() - start) / 1e6;
+    close_db(s, stats);
+    if (rc != 0) {
+      fprintf(stderr, "checkpoint failed: %s\n", err);
+      free(err);
+      return EXIT_FAILURE;
+    }
+    printf("checkpoint of %s in %s, %.1fms\n", db_path, checkpoint_path, ms);
+  } else if (db_path != NULL && backup_path != NULL) {
+    arocks_t *s = arocks_open_with(db_path, &cfg);
+    arocks_backup_report_t report;
+    char *err = NULL;
+    int rc = arocks_backup(s, backup_path, &backup_opts, &report, &err);
+    close_db(s, stats);
+    if (rc != 0) {
+      fprintf(stderr, "backup failed: %s\n", err);
+      free(err);
+      return EXIT_FAILURE;
+    }
+    arocks_backup_print(&report, stdout);
+  } else if (db_path != NULL && serve_path != NULL) {
+    mserve_block_signals();
+    arocks_t *s = arocks_open_with(db_path, &cfg);
+    mserve_opts_t opts = mserve_defaults(serve_path);
+    if (workers > 0) {
+      opts.workers = workers;
+    }
+    int rc = mserve_run(s, &opts);
+    close_db(s, stats);
+    if (rc != 0) {
+      return EXIT_FAILURE;
+    }
+  } else if (db_path != NULL && batch) {
+    arocks_t *s = arocks_open_with(db_path, &cfg);
+    mcmd_run_stream(s, stdin, stdout);
+    close_db(s, stats);
+  } else if (db_path != NULL && keys_path != NULL) {
+    arocks_t *s = arocks_open_with(db_path, &cfg);
+    multi_get_print(s, keys_path);
+    close_db(s, stats);
+  } else if (db_path != NULL && train_dict) {
+    if (cfg.zstd_dict_bytes == 0) {
+      // the compaction at the end should write dictionaries too
+      cfg.zstd_dict_bytes = AROCKS_DICT_DEFAULT_BYTES;
+    }
+    arocks_t *s = arocks_open_with(db_path, &cfg);
+    arocks_dict_opts_t opts = arocks_dict_defaults(&s->config);
+    arocks_dict_report_t report;
+    if (arocks_dict_train(s, &opts, &report) != 0) {
+      fprintf(stderr, "not enough values to train a dictionary on\n");
+    } else {
+      arocks_dict_print(&report, stdout);
+    }
+    close_db(s, stats);
+  } else if (db_path != NULL && compact) {
+    cfg.statistics = 1; // for the compaction tickers
+    arocks_t *s = arocks_open_with(db_path, &cfg);
+    arocks_compaction_stats_t before, after;
+    arocks_compaction_stats(s, &before);
+    arocks_compact(s);
+    arocks_compaction_stats(s, &after);
+    arocks_compaction_print(&before, &after, stdout);
+    close_db(s, stats);
+  } else if (db_path != NULL && index_path != NULL) {
+    arocks_t *s = arocks_open_with(db_path, &cfg);
+    printf("indexed %ld documents\n", arocks_index_create(s, index_path));
+    close_db(s, stats);
+  } else if (db_path != NULL && query_path != NULL) {
+    cJSON *lo = parse_bound(query_eq != NULL ? query_eq : query_from);
+    cJSON *hi = parse_bound(query_eq != NULL ? query_eq : query_to);
+    arocks_t *s = arocks_open_with(db_path, &cfg);
+    long n = arocks_index_query(s, query_path, lo, hi, db_count, print_entry,
+                                NULL);
+    if (n < 0) {
+      fprintf(stderr, "no index on %s, create one with -index\n", query_path);
+    } else if (n == 0) {
+      printf("no matches\n");
+    }
+    close_db(s, stats);
+    cJSON_Delete(lo);
+    cJSON_Delete(hi);
+  } else if (db_path != NULL && import_path != NULL) {
+    arocks_load_opts_t opts = arocks_load_defaults(import_path, key_field);
+    if (import_format != NULL) {
+      opts.format = strcmp(import_format, "edn") == 0 ? AROCKS_LOAD_EDN
+                                                      : AROCKS_LOAD_JSONL;
+    }
+    if (batch_size > 0) {
+      opts.batch_size = batch_size;
+    }
+    opts.disable_wal = no_wal;
+    opts.sst_dir = sst_dir;
+    opts.typed_keys = cfg.key_order == AROCKS_KEYS_TYPED;
+    arocks_t *s = arocks_open_with(db_path, &cfg);
+    long n = sst ? arocks_load_sst(s, import_path, &opts)
+                 : arocks_import(s, import_path, &opts);
+    close_db(s, stats);
+    if (n < 0) {
+      return EXIT_FAILURE;
+    }
+    printf("imported %ld documents\n", n);
+  } else if (db_path != NULL) {
     if (db_key == NULL) {
       usage(argv[0]);
-    } else if (db_value != NULL) {
-      arocks_insert(db_path, db_key, db_value);
-    } else if (db_count > 0) {
-      char *keys[db_count];
-      char *vals[db_count];
-      int n = arocks_iter(db_path, db_key, db_count, keys, vals);
-      if (n == 0) {
+    }
+    arocks_t *s = arocks_open_with(db_path, &cfg);
+    int status = EXIT_SUCCESS;
+    if (db_value != NULL) {
+      arocks_put(s, db_key, db_value);
+    } else if (db_patch != NULL) {
+      // EDN patches are stored as their JSON equivalent
+      cJSON *patch = mcmd_parse_doc(db_patch);
+      char *text = patch == NULL ? NULL : cJSON_PrintUnformatted(patch);
+      if (text == NULL || arocks_merge(s, db_key, text) != 0) {
+        fprintf(stderr, "merge patch must be a JSON or EDN document\n");
+        status = EXIT_FAILURE;
+      }
+      free(text);
+      cJSON_Delete(patch);
+    } else if (incr_path != NULL) {
+      if (arocks_increment(s, db_key, incr_path, incr_by) != 0) {
+        fprintf(stderr, "-incr needs a field path, e.g. :stats.views\n");
+        status = EXIT_FAILURE;
+      }
+    } else if (approx) {
+      uint64_t bytes;
+      uint64_t n = arocks_estimate_count(s, db_key, db_end, &bytes);
+      printf("about %llu keys, %llu bytes in sst files\n",
+             (unsigned long long)n, (unsigned long long)bytes);
+    } else if (db_count > 0 || db_end != NULL || reverse || prefix ||
+               keys_only || count_only) {
+      arocks_scan_stats_t scan;
+      arocks_scan_opts_t opts = {db_key, db_end, db_count, reverse, prefix};
+      opts.stats = prefix ? &scan : NULL;
+      opts.keys_only = keys_only;
+      if (count_only) {
+        printf("%ld keys\n", arocks_scan_each(s, &opts, NULL, NULL));
+      } else if (arocks_scan_each(s, &opts, keys_only ? print_key : print_entry,
+                                  NULL) == 0) {
         printf("key not found\n");
-      } else {
-        for (int i = 0; i < n; i++) {
-          printf("%s = %s\n", keys[i], vals[i]);
-          free(keys[i]);
-          free(vals[i]);
-        }
+      }
+      if (prefix) {
+        fprintf(stderr,
+                "prefix filters skipped %llu of %llu sst files, "
+                "%llu memtable probes; %llu blocks read, %llu from cache\n",
+                (unsigned long long)scan.sst_files_skipped,
+                (unsigned long long)scan.sst_files_checked,
+                (unsigned long long)scan.memtable_skipped,
+                (unsigned long long)scan.blocks_read,
+                (unsigned long long)scan.blocks_cached);
       }
     } else {
-      char *ret = arocks_select(db_path, db_key);
-      if (ret == NULL) {
+      arocks_view_t view;
+      if (!arocks_get_pinned(s, db_key, &view)) {
         printf("key not found\n");
       } else {
-        printf("%s\n", ret);
-        free(ret);
+        fwrite(view.data, 1, view.len, stdout);
+        printf("\n");
+        arocks_release(&view);
       }
     }
+    close_db(s, stats);
+    return status;
   }
 
   return 0;
@@ -0,0 +1,566 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "arocks.h"
+#include "arocks_txn.h"
+#include "cJSON.h"
+#include "mcmd.h"
+#include "mserve.h"
+
+// a line longer than this closes the connection
+#define MAX_LINE (64 << 20)
+// stop reading commands from a connection while this much output is queued
+#define MAX_PENDING_OUT (4 << 20)
+#define MAX_EVENTS 64
+
+mserve_opts_t mserve_defaults(const char *path) {
+  mserve_opts_t opts;
+  opts.path = path;
+  opts.workers = 0;
+  return opts;
+}
+
+/*
+** Connections
+*/
+
+/* Pending bytes are data[0, len), consumed from the front without moving
+ * the rest until the space is needed. */
+typedef struct buf {
+  char *mem;
+  size_t cap;
+  char *data;
+  size_t len;
+} buf;
+
+static void buf_append(buf *b, const char *data, size_t len) {
+  if ((size_t)(b->data - b->mem) + b->len + len > b->cap) {
+    if (b->len > 0) {
+      memmove(b->mem, b->data, b->len);
+    }
+    if (b->len + len > b->cap) {
+      b->cap = (b->len + len) * 2;
+      b->mem = realloc(b->mem, b->cap);
+    }
+    b->data = b->mem;
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+static void buf_consume(buf *b, size_t len) {
+  b->data += len;
+  b->len -= len;
+}
+
+typedef struct conn {
+  int fd;
+  buf in;
+  buf out;
+  int busy;         // a command is with the workers
+  int eof;          // the client shut down its side
+  int dropped;      // gone while busy, out of epoll until the command's back
+  uint32_t events;  // what epoll is watching for
+  char *command; // with the workers, then the response
+  struct conn *next; // in the job or done queue
+} conn;
+
+typedef struct server {
+  arocks_t *s;
+  int epfd;
+  int wakefd; // eventfd, workers signal finished commands on it
+  // commands waiting for a worker
+  pthread_mutex_t jobs_lock;
+  pthread_cond_t jobs_ready;
+  conn *jobs;
+  conn **jobs_tail;
+  int quit;
+  // commands the workers have finished
+  pthread_mutex_t done_lock;
+  conn *done;
+  // index creation swaps the session's index list, everything else shares
+  // (writes to one key take turns in the session, see arocks.h)
+  pthread_rwlock_t session_lock;
+  long conns;
+} server;
+
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Snapshots the client didn't release, and transactions it didn't commit,
+ * go with it. */
+static void conn_close(server *sv, conn *c) {
+  arocks_snapshot_release_owned(sv->s, c);
+  arocks_txn_rollback_owned(sv->s, c);
+  if (!c->dropped) {
+    epoll_ctl(sv->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  }
+  close(c->fd);
+  free(c->in.mem);
+  free(c->out.mem);
+  free(c);
+  sv->conns--;
+}
+
+/* Input until the client shuts down its side, or while it isn't reading its
+ * responses, output while any is queued. Level triggered, so nothing is
+ * watched that can't be acted on. */
+static void watch(server *sv, conn *c) {
+  int reading = !c->eof && c->out.len < MAX_PENDING_OUT;
+  uint32_t events = (reading ? EPOLLIN | EPOLLRDHUP : 0) |
+                    (c->out.len > 0 ? EPOLLOUT : 0);
+  if (events == c->events) {
+    return;
+  }
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = c;
+  epoll_ctl(sv->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+  c->events = events;
+}
+
+/* Write what's queued, returns -1 if the client is gone. */
+static int conn_flush(server *sv, conn *c) {
+  size_t off = 0;
+  while (off < c->out.len) {
+    ssize_t n = write(c->fd, c->out.data + off, c->out.len - off);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    off += (size_t)n;
+  }
+  buf_consume(&c->out, off);
+  watch(sv, c);
+  return 0;
+}
+
+static void enqueue(server *sv, conn *c) {
+  pthread_mutex_lock(&sv->jobs_lock);
+  c->next = NULL;
+  *sv->jobs_tail = c;
+  sv->jobs_tail = &c->next;
+  pthread_cond_signal(&sv->jobs_ready);
+  pthread_mutex_unlock(&sv->jobs_lock);
+}
+
+/* Hand the next complete line to the workers, unless one is already with
+ * them or the client isn't reading its responses. Returns -1 once the
+ * connection is finished with. */
+static int conn_dispatch(server *sv, conn *c) {
+  while (!c->busy && c->out.len < MAX_PENDING_OUT) {
+    char *nl = memchr(c->in.data, '\n', c->in.len);
+    size_t len = nl != NULL ? (size_t)(nl - c->in.data) : c->in.len;
+    if (nl == NULL && !(c->eof && len > 0)) {
+      break; // a last line without a newline still counts at EOF
+    }
+    char *line = strndup(c->in.data, len);
+    buf_consume(&c->in, nl != NULL ? len + 1 : len);
+    const char *p = line;
+    while (*p != '\0' && (unsigned char)*p <= 32) {
+      p++;
+    }
+    if (*p == '\0') {
+      free(line); // blank line
+      continue;
+    }
+    c->command = line;
+    c->busy = 1;
+    enqueue(sv, c);
+  }
+  if (c->eof && !c->busy && c->in.len == 0 && c->out.len == 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static void conn_read(server *sv, conn *c) {
+  char chunk[65536];
+  for (;;) {
+    ssize_t n = read(c->fd, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (n <= 0) {
+      c->eof = 1;
+      break;
+    }
+    buf_append(&c->in, chunk, (size_t)n);
+  }
+  if (c->in.len > MAX_LINE && memchr(c->in.data, '\n', c->in.len) == NULL) {
+    fprintf(stderr, "Dropping a client sending a line over %d bytes\n",
+            MAX_LINE);
+    c->eof = 1;
+    c->in.len = 0;
+  }
+  watch(sv, c);
+}
+
+static void accept_all(server *sv, int lfd) {
+  for (;;) {
+    int fd = accept(lfd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("accept");
+      }
+      return;
+    }
+    set_nonblocking(fd);
+    conn *c = calloc(1, sizeof(conn));
+    c->fd = fd;
+    c->events = EPOLLIN | EPOLLRDHUP;
+    struct epoll_event ev;
+    ev.events = c->events;
+    ev.data.ptr = c;
+    epoll_ctl(sv->epfd, EPOLL_CTL_ADD, fd, &ev);
+    sv->conns++;
+  }
+}
+
+/* Queue the responses the workers finished and move each connection on. */
+static void collect_done(server *sv) {
+  uint64_t count;
+  if (read(sv->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    perror("eventfd");
+  }
+  pthread_mutex_lock(&sv->done_lock);
+  conn *c = sv->done;
+  sv->done = NULL;
+  pthread_mutex_unlock(&sv->done_lock);
+  while (c != NULL) {
+    conn *next = c->next;
+    if (c->dropped) {
+      free(c->command);
+      conn_close(sv, c);
+      c = next;
+      continue;
+    }
+    buf_append(&c->out, c->command, strlen(c->command));
+    buf_append(&c->out, "\n", 1);
+    free(c->command);
+    c->command = NULL;
+    c->busy = 0;
+    if (conn_flush(sv, c) != 0 || conn_dispatch(sv, c) != 0) {
+      conn_close(sv, c);
+    }
+    c = next;
+  }
+}
+
+/*
+** Workers
+*/
+
+/* Snapshots a command takes belong to its connection, c. */
+static char *run_command(server *sv, const conn *c, const char *line) {
+  cJSON *cmd = mcmd_parse_doc(line);
+  if (cmd == NULL) {
+    return mcmd_exec_line(sv->s, line); // for its parse error
+  }
+  const char *op = cJSON_GetStringValue(cJSON_GetObjectItem(cmd, "op"));
+  int exclusive = op != NULL && strcmp(op, "index") == 0;
+  if (exclusive) {
+    pthread_rwlock_wrlock(&sv->session_lock);
+  } else {
+    pthread_rwlock_rdlock(&sv->session_lock);
+  }
+  cJSON *res = mcmd_exec_owned(sv->s, cmd, c);
+  pthread_rwlock_unlock(&sv->session_lock);
+  char *out = cJSON_PrintUnformatted(res);
+  cJSON_Delete(res);
+  cJSON_Delete(cmd);
+  return out;
+}
+
+static void *worker(void *arg) {
+  server *sv = arg;
+  for (;;) {
+    pthread_mutex_lock(&sv->jobs_lock);
+    while (sv->jobs == NULL && !sv->quit) {
+      pthread_cond_wait(&sv->jobs_ready, &sv->jobs_lock);
+    }
+    conn *c = sv->jobs;
+    if (c == NULL) {
+      pthread_mutex_unlock(&sv->jobs_lock);
+      return NULL; // quitting, and nothing left to run
+    }
+    sv->jobs = c->next;
+    if (sv->jobs == NULL) {
+      sv->jobs_tail = &sv->jobs;
+    }
+    pthread_mutex_unlock(&sv->jobs_lock);
+
+    char *res = run_command(sv, c, c->command);
+    free(c->command);
+    c->command = res;
+
+    pthread_mutex_lock(&sv->done_lock);
+    c->next = sv->done;
+    sv->done = c;
+    pthread_mutex_unlock(&sv->done_lock);
+    uint64_t one = 1;
+    if (write(sv->wakefd, &one, sizeof(one)) < 0) {
+      perror("eventfd");
+    }
+  }
+}
+
+/*
+** Server
+*/
+
+static int listen_on(const char *path) {
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+  struct stat st;
+  if (stat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      fprintf(stderr, "%s exists and isn't a socket\n", path);
+      return -1;
+    }
+    unlink(path); // left behind by a server that didn't shut down
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  set_nonblocking(fd);
+  return fd;
+}
+
+static void server_signals(sigset_t *signals) {
+  sigemptyset(signals);
+  sigaddset(signals, SIGINT);
+  sigaddset(signals, SIGTERM);
+}
+
+void mserve_block_signals(void) {
+  // threads inherit the mask, so only the signalfd sees these
+  sigset_t signals;
+  server_signals(&signals);
+  sigaddset(&signals, SIGPIPE); // writes to closed clients fail with EPIPE
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+}
+
+int mserve_run(arocks_t *s, const mserve_opts_t *opts) {
+  int lfd = listen_on(opts->path);
+  if (lfd < 0) {
+    return -1;
+  }
+  mserve_block_signals();
+  sigset_t signals;
+  server_signals(&signals);
+  int sigfd = signalfd(-1, &signals, SFD_NONBLOCK);
+
+  server sv;
+  memset(&sv, 0, sizeof(sv));
+  sv.s = s;
+  sv.epfd = epoll_create1(0);
+  sv.wakefd = eventfd(0, EFD_NONBLOCK);
+  pthread_mutex_init(&sv.jobs_lock, NULL);
+  pthread_cond_init(&sv.jobs_ready, NULL);
+  sv.jobs_tail = &sv.jobs;
+  pthread_mutex_init(&sv.done_lock, NULL);
+  pthread_rwlock_init(&sv.session_lock, NULL);
+
+  // the listening socket, eventfd and signalfd are told apart by data.fd,
+  // connections carry their conn
+  int fds[] = {lfd, sv.wakefd, sigfd};
+  for (int i = 0; i < 3; i++) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &fds[i];
+    epoll_ctl(sv.epfd, EPOLL_CTL_ADD, fds[i], &ev);
+  }
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int nworkers = opts->workers > 0 ? opts->workers : (int)cpus;
+  pthread_t *threads = malloc(nworkers * sizeof(pthread_t));
+  for (int i = 0; i < nworkers; i++) {
+    pthread_create(&threads[i], NULL, worker, &sv);
+  }
+  fprintf(stderr, "serving %s with %d workers\n", opts->path, nworkers);
+
+  int stop = 0;
+  struct epoll_event events[MAX_EVENTS];
+  while (!stop) {
+    int n = epoll_wait(sv.epfd, events, MAX_EVENTS, -1);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    for (int i = 0; i < n; i++) {
+      void *ptr = events[i].data.ptr;
+      if (ptr == &fds[0]) {
+        accept_all(&sv, lfd);
+      } else if (ptr == &fds[1]) {
+        collect_done(&sv);
+      } else if (ptr == &fds[2]) {
+        stop = 1;
+      } else {
+        conn *c = ptr;
+        uint32_t e = events[i].events;
+        // both sides closed (a half close is EPOLLRDHUP), nothing to answer
+        int gone = (e & (EPOLLERR | EPOLLHUP)) != 0;
+        if (!gone && (e & EPOLLOUT)) {
+          gone = conn_flush(&sv, c) != 0;
+        }
+        if (!gone && (e & (EPOLLIN | EPOLLRDHUP))) {
+          conn_read(&sv, c);
+        }
+        if (!gone) {
+          gone = conn_dispatch(&sv, c) != 0;
+        }
+        // a busy connection is freed once its command comes back
+        if (gone && c->busy) {
+          epoll_ctl(sv.epfd, EPOLL_CTL_DEL, c->fd, NULL);
+          c->dropped = 1;
+        } else if (gone) {
+          conn_close(&sv, c);
+        }
+      }
+    }
+  }
+  fprintf(stderr, "shutting down, %ld clients connected\n", sv.conns);
+
+  close(lfd);
+  unlink(opts->path);
+  pthread_mutex_lock(&sv.jobs_lock);
+  sv.quit = 1;
+  pthread_cond_broadcast(&sv.jobs_ready);
+  pthread_mutex_unlock(&sv.jobs_lock);
+  for (int i = 0; i < nworkers; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  // answer what the workers finished, connections still open are dropped
+  collect_done(&sv);
+
+  close(sigfd);
+  close(sv.wakefd);
+  close(sv.epfd);
+  pthread_mutex_destroy(&sv.jobs_lock);
+  pthread_cond_destroy(&sv.jobs_ready);
+  pthread_mutex_destroy(&sv.done_lock);
+  pthread_rwlock_destroy(&sv.session_lock);
+  return 0;
+}
+
+/*
+** Client
+*/
+
+int mserve_connect(const char *path) {
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+typedef struct sender {
+  int fd;
+  FILE *in;
+  long sent;
+} sender;
+
+/* Send every command without waiting on responses, then shut down the
+ * write side so the server knows there are no more. */
+static void *send_commands(void *arg) {
+  sender *snd = arg;
+  FILE *out = fdopen(dup(snd->fd), "w");
+  char *line = NULL;
+  size_t cap = 0;
+  while (getline(&line, &cap, snd->in) != -1) {
+    const char *p = line;
+    while (*p != '\0' && (unsigned char)*p <= 32) {
+      p++;
+    }
+    if (*p == '\0') {
+      continue; // blank lines get no response
+    }
+    size_t len = strlen(line);
+    if (fwrite(line, 1, len, out) != len ||
+        (line[len - 1] != '\n' && fputc('\n', out) == EOF)) {
+      break;
+    }
+    snd->sent++;
+  }
+  free(line);
+  fclose(out);
+  shutdown(snd->fd, SHUT_WR);
+  return NULL;
+}
+
+long mserve_client_stream(int fd, FILE *in, FILE *out) {
+  // the server answers a broken pipe by closing, which read() sees too
+  signal(SIGPIPE, SIG_IGN);
+  sender snd = {fd, in, 0};
+  pthread_t thread;
+  pthread_create(&thread, NULL, send_commands, &snd);
+  FILE *responses = fdopen(dup(fd), "r");
+  char *line = NULL;
+  size_t cap = 0;
+  long n = 0;
+  while (getline(&line, &cap, responses) != -1) {
+    fputs(line, out);
+    n++;
+  }
+  free(line);
+  fclose(responses);
+  pthread_join(thread, NULL);
+  fflush(out);
+  return n < snd.sent ? -1 : n;
+}
@@ -0,0 +1,52 @@
+#ifndef MSERVE_H_
+#define MSERVE_H_
+
+#include <stdio.h>
+
+#include "arocks.h"
+
+/*
+** Server mode: one session, so one rocksdb_t, serving modric commands (see
+** mcmd.h) over a Unix domain socket instead of a process per request. The
+** framing is -batch's: one JSON or EDN command per line in, one unformatted
+** JSON response per line out.
+**
+** An epoll loop owns the sockets and does all the I/O. Complete lines go to
+** a pool of worker threads that run them against the session. Each
+** connection has at most one command with the workers at a time, so its
+** responses come back in order while different connections run in
+** parallel. Clients may send any number of commands ahead (pipelining) and
+** shut down their write side when done, the server answers everything
+** before closing.
+**
+** Index creation runs alone, other commands run concurrently (writes to
+** one key take turns in the session, see arocks.h). Snapshots and
+** transactions belong to the connection that began them and are released
+** (rolled back) when it closes.
+*/
+
+typedef struct mserve_opts {
+  const char *path; // socket path, a stale socket there is replaced
+  int workers;      // worker threads, 0 for one per CPU
+} mserve_opts_t;
+
+mserve_opts_t mserve_defaults(const char *path);
+
+/* Block the signals the server handles, before the session is opened: a
+ * thread started earlier (RocksDB's, the group committer) would otherwise
+ * take SIGTERM and end the process without a clean shutdown. */
+void mserve_block_signals(void);
+
+/* Serve until SIGINT or SIGTERM, then finish the commands already running
+ * and remove the socket. Returns 0, or -1 if the socket can't be set up. */
+int mserve_run(arocks_t *s, const mserve_opts_t *opts);
+
+/* Connect to a server, returns the socket or -1. */
+int mserve_connect(const char *path);
+
+/* Send the commands in in (one per line) over fd and write each response
+ * to out, in order. Returns the number of responses, or -1 if the server
+ * went away before answering everything. */
+long mserve_client_stream(int fd, FILE *in, FILE *out);
+
+#endif // MSERVE_H_